@@ -0,0 +1,349 @@
+#include "Lambda.h"
+#include "TypeStore.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+/// The types `List<i64>`, `List.Cons<i64>`, and `List.Empty<i64>` declared in a store.
+struct Lists {
+
+  /// The store in which the types are declared.
+  xst::TypeStore store;
+
+  /// The type `i64`.
+  xst::BuiltinHeader const* i64;
+
+  /// The type `List<i64>`.
+  xst::EnumHeader const* list;
+
+  /// The type `List.Cons<i64>`.
+  xst::StructHeader const* cons;
+
+  /// The type `List.Empty<i64>`.
+  xst::StructHeader const* empty;
+
+  /// Creates an instance declaring and defining the types of lists.
+  Lists() {
+    i64 = store.declare(xst::BuiltinHeader::i64);
+    list = store.declare(xst::EnumHeader("List", {i64}));
+    cons = store.declare(xst::StructHeader("List.Cons", {i64}));
+    empty = store.declare(xst::StructHeader("List.Empty", {i64}));
+    store.define(cons, {xst::Field{i64}, xst::Field{list, true}});
+    store.define(empty, {});
+    store.define(list, {xst::Field{cons}, xst::Field{empty}});
+  }
+
+  /// Initializes `target` with a list of `n` elements, counting down from `n - 1` to zero.
+  void build(void* target, std::size_t n) {
+    std::byte none[1] = {};
+    store.copy_initialize_enum(list, 1, target, none);
+
+    // Each element is prepended by moving the list built so far into the tail of a new cell.
+    std::vector<std::byte> c(store.size(cons));
+    for (std::size_t i = 0; i < n; ++i) {
+      std::memset(c.data(), 0, c.size());
+      store.copy_initialize_builtin(
+        i64, store.address_of(cons, 0, c.data()), static_cast<int64_t>(i));
+      store.move_initialize(list, store.address_of(cons, 1, c.data()), target);
+      store.move_initialize_enum(list, 0, target, c.data());
+    }
+  }
+
+};
+
+/// The types `Tree<i64>`, `Tree.Node<i64>`, and `Tree.Leaf<i64>` declared in a store.
+struct Trees {
+
+  /// The allocator of the values of `store`, which can be used by multiple threads.
+  xst::ThreadCachingAllocator allocator;
+
+  /// The store in which the types are declared.
+  xst::TypeStore store{allocator};
+
+  /// The type `i64`.
+  xst::BuiltinHeader const* i64;
+
+  /// The type `Tree<i64>`.
+  xst::EnumHeader const* tree;
+
+  /// The type `Tree.Node<i64>`.
+  xst::StructHeader const* node;
+
+  /// The type `Tree.Leaf<i64>`.
+  xst::StructHeader const* leaf;
+
+  /// Creates an instance declaring and defining the types of trees.
+  Trees() {
+    i64 = store.declare(xst::BuiltinHeader::i64);
+    tree = store.declare(xst::EnumHeader("Tree", {i64}));
+    node = store.declare(xst::StructHeader("Tree.Node", {i64}));
+    leaf = store.declare(xst::StructHeader("Tree.Leaf", {i64}));
+    store.define(node, {xst::Field{i64}, xst::Field{tree, true}, xst::Field{tree, true}});
+    store.define(leaf, {});
+    store.define(tree, {xst::Field{node}, xst::Field{leaf}});
+  }
+
+  /// Initializes `target` with a perfect binary tree of the given `depth`.
+  void build(void* target, std::size_t depth) {
+    if (depth == 0) {
+      std::byte none[1] = {};
+      store.copy_initialize_enum(tree, 1, target, none);
+      return;
+    }
+
+    std::vector<std::byte> c(store.size(node));
+    store.copy_initialize_builtin(
+      i64, store.address_of(node, 0, c.data()), static_cast<int64_t>(depth));
+    build(store.address_of(node, 1, c.data()), depth - 1);
+    build(store.address_of(node, 2, c.data()), depth - 1);
+    store.move_initialize_enum(tree, 0, target, c.data());
+  }
+
+};
+
+/// Returns the names `T0`, `T1`, ..., of `n` distinct types.
+std::vector<std::string> names(std::size_t n) {
+  std::vector<std::string> result;
+  for (std::size_t i = 0; i < n; ++i) { result.push_back("T" + std::to_string(i)); }
+  return result;
+}
+
+/// Measures the interning of `range(0)` headers `T0<i64>`, `T1<i64>`, ... that haven't been
+/// declared yet.
+void declare_new(benchmark::State& state) {
+  auto ns = names(static_cast<std::size_t>(state.range(0)));
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto store = std::make_unique<xst::TypeStore>();
+    auto i64 = store->declare(xst::BuiltinHeader::i64);
+    state.ResumeTiming();
+
+    for (auto const& n : ns) {
+      benchmark::DoNotOptimize(store->declare(xst::StructHeader(n.c_str(), {i64})));
+    }
+
+    state.PauseTiming();
+    store.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(declare_new)->RangeMultiplier(8)->Range(64, 1 << 15);
+
+/// Measures the interning of headers that have already been declared.
+void declare_interned(benchmark::State& state) {
+  xst::TypeStore store;
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  store.declare(xst::StructHeader("Pair", {i64, i64}));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(store.declare(xst::StructHeader("Pair", {i64, i64})));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(declare_interned);
+
+/// Measures the memoized instantiation of a generic type that has already been instantiated.
+void instantiate_memoized(benchmark::State& state) {
+  xst::TypeStore store;
+  auto pair = store.register_constructor(xst::TypeHeader::product, "Pair", 1,
+    [](xst::TypeStore& s, xst::TypeHeader const* t, std::span<xst::TypeHeader const* const> a) {
+      s.define(static_cast<xst::StructHeader const*>(t), {xst::Field{a[0]}, xst::Field{a[0]}});
+    });
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  store.instantiate(pair, {i64});
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(store.instantiate(pair, {i64}));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(instantiate_memoized)->ThreadRange(1, 4);
+
+/// Returns the sum of `environment` and `x`.
+uint64_t add(uint64_t environment, uint64_t x) {
+  return environment + x;
+}
+
+/// Measures calls to a lambda implemented by a native function, which receives its argument by
+/// address through its adapter.
+void call_lambda(benchmark::State& state) {
+  xst::TypeStore store;
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  auto type = store.declare_lambda({i64, i64, i64});
+  using Binding = xst::Lambda<uint64_t(uint64_t, uint64_t)>;
+  Binding binding{store, type};
+
+  store.with_temporary_allocation(type, 1, [&](void* p) {
+    binding.initialize(p, Binding::implement<add>(), 10);
+    uint64_t x = 0;
+    for (auto _ : state) {
+      x = binding(p, x);
+      benchmark::DoNotOptimize(x);
+    }
+  });
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(call_lambda);
+
+/// Measures the lookup of the metatypes of defined types, cycling through `range(0)` types.
+void metatype_lookup(benchmark::State& state) {
+  xst::TypeStore store;
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  std::vector<xst::TypeHeader const*> types;
+  for (auto const& n : names(static_cast<std::size_t>(state.range(0)))) {
+    auto t = store.declare(xst::StructHeader(n.c_str(), {i64}));
+    store.define(t, {xst::Field{i64}});
+    types.push_back(t);
+  }
+
+  auto mask = types.size() - 1;
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&store[types[i++ & mask]]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(metatype_lookup)->RangeMultiplier(16)->Range(16, 1 << 16);
+
+/// Measures the copy of lists of `range(0)` elements.
+void copy_list(benchmark::State& state) {
+  Lists l;
+  auto n = static_cast<std::size_t>(state.range(0));
+  std::vector<std::byte> source(l.store.size(l.list)), target(source.size());
+  l.build(source.data(), n);
+  for (auto _ : state) {
+    l.store.copy_initialize(l.list, target.data(), source.data());
+    state.PauseTiming();
+    l.store.deinitialize(l.list, target.data());
+    state.ResumeTiming();
+  }
+  l.store.deinitialize(l.list, source.data());
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(copy_list)
+  ->RangeMultiplier(8)->Range(1, 1 << 20)->Unit(benchmark::kMicrosecond);
+
+/// Measures the destruction of lists of `range(0)` elements.
+void deinitialize_list(benchmark::State& state) {
+  Lists l;
+  auto n = static_cast<std::size_t>(state.range(0));
+  std::vector<std::byte> source(l.store.size(l.list)), target(source.size());
+  l.build(source.data(), n);
+  for (auto _ : state) {
+    state.PauseTiming();
+    l.store.copy_initialize(l.list, target.data(), source.data());
+    state.ResumeTiming();
+    l.store.deinitialize(l.list, target.data());
+  }
+  l.store.deinitialize(l.list, source.data());
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(deinitialize_list)
+  ->RangeMultiplier(8)->Range(1, 1 << 20)->Unit(benchmark::kMicrosecond);
+
+/// Measures the copy of lists of `range(0)` elements into a region, which is then dropped.
+void copy_list_to_region(benchmark::State& state) {
+  Lists l;
+  auto n = static_cast<std::size_t>(state.range(0));
+  std::vector<std::byte> source(l.store.size(l.list)), target(source.size());
+  l.build(source.data(), n);
+  for (auto _ : state) {
+    xst::Region r;
+    l.store.copy_initialize(l.list, target.data(), source.data(), r);
+    l.store.deinitialize(l.list, target.data(), r);
+  }
+  l.store.deinitialize(l.list, source.data());
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(copy_list_to_region)
+  ->RangeMultiplier(8)->Range(1, 1 << 20)->Unit(benchmark::kMicrosecond);
+
+/// Measures the copy and destruction of perfect binary trees of depth `range(0)`, using a pool of
+/// `range(1)` workers, or the calling thread alone if `range(1)` is zero.
+void copy_tree(benchmark::State& state) {
+  Trees t;
+  std::vector<std::byte> source(t.store.size(t.tree)), target(source.size());
+  t.build(source.data(), static_cast<std::size_t>(state.range(0)));
+  xst::ThreadPool pool(static_cast<std::size_t>(std::max<int64_t>(state.range(1), 1)));
+  for (auto _ : state) {
+    if (state.range(1) == 0) {
+      t.store.copy_initialize(t.tree, target.data(), source.data());
+      t.store.deinitialize(t.tree, target.data());
+    } else {
+      t.store.copy_initialize(t.tree, target.data(), source.data(), pool);
+      t.store.deinitialize(t.tree, target.data(), pool);
+    }
+  }
+  t.store.deinitialize(t.tree, source.data());
+  state.SetItemsProcessed(state.iterations() * ((int64_t{1} << state.range(0)) - 1));
+}
+BENCHMARK(copy_tree)
+  ->ArgsProduct({{12, 16, 20}, {0, 1, 2, 4, 8}})->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+/// Measures the copy of arrays of enums whose layouts have different strides.
+///
+/// The enum is `Maybe<T>`, whose cases are `Some<T>` and `None`, where `T` is the built-in type
+/// identified by `range(0)`. The stride of the enum is reported with the results.
+void enum_stride(benchmark::State& state) {
+  constexpr std::size_t count = 4096;
+
+  xst::TypeStore store;
+  auto t = store.declare(static_cast<xst::BuiltinHeader::Value>(state.range(0)));
+  auto maybe = store.declare(xst::EnumHeader("Maybe", {t}));
+  auto some = store.declare(xst::StructHeader("Maybe.Some", {t}));
+  auto none = store.declare(xst::StructHeader("Maybe.None", {t}));
+  store.define(some, {xst::Field{t}});
+  store.define(none, {});
+  store.define(maybe, {xst::Field{some}, xst::Field{none}});
+
+  // Alternate between both cases so that the copy can't be specialized for one of them.
+  auto d = store.stride(maybe);
+  std::vector<std::byte> payload(store.size(some) + 1), source(d * count), target(source.size());
+  for (std::size_t i = 0; i < count; ++i) {
+    store.copy_initialize_enum(maybe, i % 2, source.data() + i * d, payload.data());
+  }
+
+  for (auto _ : state) {
+    store.copy_initialize_n(maybe, target.data(), source.data(), count);
+    benchmark::ClobberMemory();
+    store.deinitialize_n(maybe, target.data(), count);
+  }
+  store.deinitialize_n(maybe, source.data(), count);
+  state.SetLabel(std::string{store.description(maybe)});
+  state.counters["stride"] = static_cast<double>(d);
+  state.SetItemsProcessed(state.iterations() * count);
+  state.SetBytesProcessed(state.iterations() * count * d);
+}
+BENCHMARK(enum_stride)
+  ->Arg(xst::BuiltinHeader::boolean)
+  ->Arg(xst::BuiltinHeader::i32)
+  ->Arg(xst::BuiltinHeader::i64)
+  ->Arg(xst::BuiltinHeader::ptr);
+
+/// Measures the description of lists of `range(0)` elements.
+void dump_list(benchmark::State& state) {
+  Lists l;
+  std::vector<std::byte> source(l.store.size(l.list));
+  l.build(source.data(), static_cast<std::size_t>(state.range(0)));
+  std::size_t written = 0;
+  for (auto _ : state) {
+    xst::OutputBuffer o;
+    l.store.dump_instance(o, l.list, source.data());
+    written += o.view().size();
+    benchmark::DoNotOptimize(o.contents.data());
+  }
+  l.store.deinitialize(l.list, source.data());
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(static_cast<int64_t>(written));
+}
+BENCHMARK(dump_list)->RangeMultiplier(8)->Range(8, 1 << 15);
+
+}
+
+BENCHMARK_MAIN();
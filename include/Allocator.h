@@ -0,0 +1,230 @@
+#pragma once
+
+#include "Arena.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace xst {
+
+/// A strategy to allocate the out-of-line storage of runtime values.
+struct Allocator {
+
+  /// Destroys `this`.
+  virtual ~Allocator() = default;
+
+  /// Returns the address of `size` bytes of uninitialized storage aligned at `alignment`.
+  ///
+  /// - Requires: `size` is greater than zero and `alignment` is a power of two.
+  virtual void* allocate(std::size_t size, std::size_t alignment) = 0;
+
+  /// Deallocates the storage at `p`.
+  ///
+  /// - Requires: `p` has been returned by a call to `allocate` on `this` with the same `size` and
+  ///   `alignment`, and it hasn't been deallocated yet.
+  virtual void deallocate(void* p, std::size_t size, std::size_t alignment) = 0;
+
+  /// Returns `true` iff a copy whose out-of-line storage is allocated by `this` can share the
+  /// shared box whose payload is at `payload` with its original, rather than copying it.
+  virtual bool can_share([[maybe_unused]] void const* payload) const {
+    return true;
+  }
+
+  /// Returns an allocator that uses the global heap.
+  static Allocator& heap();
+
+};
+
+/// An allocator that uses the global heap.
+struct HeapAllocator final : public Allocator {
+
+  void* allocate(std::size_t size, std::size_t alignment) override;
+
+  void deallocate(void* p, std::size_t size, std::size_t alignment) override;
+
+};
+
+/// An allocator that serves small allocations from free lists of fixed-size blocks.
+///
+/// Allocations whose size rounds up to one of `class_count` size classes, which are multiples of
+/// `granule`, are served from slabs of `slab_size` bytes that are split into blocks of the same
+/// class. Deallocated blocks are recycled and slabs are only released when the allocator is
+/// destroyed. Other allocations go to the global heap. An instance can be used from multiple
+/// threads concurrently.
+struct PoolAllocator final : public Allocator {
+
+  /// The difference between the block sizes of two consecutive size classes.
+  static constexpr std::size_t granule = 16;
+
+  /// The number of size classes.
+  static constexpr std::size_t class_count = 16;
+
+  /// The size of a slab.
+  static constexpr std::size_t slab_size = 64 << 10;
+
+  /// Returns `true` iff allocations with the given size and alignment are served from slabs.
+  static constexpr bool pooled(std::size_t size, std::size_t alignment) {
+    return (size <= granule * class_count) && (alignment <= granule);
+  }
+
+  /// Returns the size class of allocations of `size` bytes.
+  ///
+  /// - Requires: `pooled(size, a)` for some alignment `a`.
+  static constexpr std::size_t class_of(std::size_t size) {
+    return (size - 1) / granule;
+  }
+
+  /// Creates an instance without any slab.
+  PoolAllocator() = default;
+
+  PoolAllocator(PoolAllocator const&) = delete;
+
+  PoolAllocator& operator=(PoolAllocator const&) = delete;
+
+  /// Destroys `this`, deallocating all its slabs.
+  ~PoolAllocator();
+
+  void* allocate(std::size_t size, std::size_t alignment) override;
+
+  void deallocate(void* p, std::size_t size, std::size_t alignment) override;
+
+  /// Writes the addresses of up to `n` free blocks of size class `c` to `blocks` and returns the
+  /// number of addresses written, which is greater than zero.
+  std::size_t allocate_blocks(std::size_t c, void** blocks, std::size_t n);
+
+  /// Returns the `n` blocks of size class `c` whose addresses are in `blocks` to the free lists.
+  void deallocate_blocks(std::size_t c, void* const* blocks, std::size_t n);
+
+private:
+
+  /// A free block.
+  struct Block {
+
+    /// The next free block in the same size class, if any.
+    Block* next;
+
+  };
+
+  /// The lock protecting the free lists and slabs.
+  std::mutex mutex;
+
+  /// The free lists, one for each size class.
+  std::array<Block*, class_count> free_lists{};
+
+  /// The slabs allocated by this instance.
+  std::vector<void*> slabs;
+
+  /// Splits a new slab into blocks of size class `c` and adds them to the corresponding free list.
+  ///
+  /// - Requires: `mutex` is locked.
+  void refill(std::size_t c);
+
+};
+
+/// An allocator that carves storage out of an arena and releases it all at once when it is
+/// destroyed.
+///
+/// Deallocating storage allocated by a region is a no-op. Hence, values whose out-of-line storage
+/// is allocated in a region, which are built with the overloads of `TypeStore` accepting a region,
+/// don't have to be deinitialized: they are all dropped in constant time per chunk when the region
+/// is destroyed, without visiting their parts. Such values must not refer to storage allocated
+/// by another allocator, since that storage would never be released, and must not be
+/// deinitialized with another allocator either. Hence, copies into a region only share the shared
+/// boxes that the region allocated, and copy the others.
+///
+/// A region is not thread-safe.
+struct Region final : public Allocator {
+
+  /// Creates an empty instance allocating regular chunks of `chunk_size` bytes.
+  explicit Region(std::size_t chunk_size = 64 << 10) : arena(chunk_size) {}
+
+  Region(Region const&) = delete;
+
+  Region& operator=(Region const&) = delete;
+
+  /// Destroys `this`, releasing all the storage that it allocated.
+  ~Region() = default;
+
+  inline void* allocate(std::size_t size, std::size_t alignment) override {
+    allocated += size;
+    return arena.allocate(size, alignment);
+  }
+
+  inline void deallocate(void*, std::size_t, std::size_t) override {}
+
+  inline bool can_share(void const* payload) const override {
+    return arena.contains(payload);
+  }
+
+  /// Returns the number of bytes allocated in `this`.
+  inline std::size_t allocated_bytes() const {
+    return allocated;
+  }
+
+private:
+
+  /// The arena in which storage is allocated.
+  Arena arena;
+
+  /// The number of bytes allocated in `this`.
+  std::size_t allocated = 0;
+
+};
+
+/// An allocator that serves small allocations from per-thread caches of free blocks, backed by a
+/// pool allocator.
+///
+/// Each thread using an instance gets its own cache, so that allocations and deallocations only
+/// lock the underlying pool when a cache must be refilled or flushed. Blocks may be deallocated
+/// by a different thread than the one that allocated them.
+struct ThreadCachingAllocator final : public Allocator {
+
+  /// Creates an instance whose caches hold up to `cache_capacity` blocks per size class.
+  explicit ThreadCachingAllocator(std::size_t cache_capacity = 64);
+
+  ThreadCachingAllocator(ThreadCachingAllocator const&) = delete;
+
+  ThreadCachingAllocator& operator=(ThreadCachingAllocator const&) = delete;
+
+  /// Destroys `this`, deallocating all the storage that it allocated.
+  ~ThreadCachingAllocator();
+
+  void* allocate(std::size_t size, std::size_t alignment) override;
+
+  void deallocate(void* p, std::size_t size, std::size_t alignment) override;
+
+private:
+
+  /// The free blocks cached by a thread.
+  struct Cache {
+
+    /// The free blocks of each size class.
+    std::array<std::vector<void*>, PoolAllocator::class_count> bins;
+
+  };
+
+  /// A number identifying this instance uniquely for the lifetime of the program.
+  std::uint64_t identity;
+
+  /// The maximum number of blocks in a bin.
+  std::size_t cache_capacity;
+
+  /// The allocator from which caches are refilled.
+  PoolAllocator pool;
+
+  /// The lock protecting `caches`.
+  std::mutex mutex;
+
+  /// The caches of the threads that used this instance.
+  std::vector<std::unique_ptr<Cache>> caches;
+
+  /// Returns the cache of the calling thread.
+  Cache& local_cache();
+
+};
+
+}
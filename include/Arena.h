@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace xst {
+
+/// A region of memory in which objects are allocated contiguously and deallocated in bulk.
+///
+/// Memory is carved out of chunks of `chunk_size` bytes, or of a dedicated chunk for allocations
+/// that are too large to fit comfortably in a regular one. No memory is given back before the
+/// arena is destroyed, at which point the objects created by `create` are destroyed in the reverse
+/// order of their creation.
+///
+/// An arena is not thread-safe.
+struct Arena {
+private:
+
+  /// The header of a chunk of memory allocated by an arena.
+  struct Chunk {
+
+    /// The chunk allocated before this one, if any.
+    Chunk* next;
+
+    /// The number of bytes following this header in the chunk.
+    std::size_t capacity;
+
+  };
+
+  /// A record of an object that must be destroyed when the arena is destroyed.
+  struct Finalizer {
+
+    /// The finalizer registered before this one, if any.
+    Finalizer* next;
+
+    /// A function that destroys `object`.
+    void (*destroy)(void*);
+
+    /// The object to destroy.
+    void* object;
+
+  };
+
+  /// The chunks allocated by this arena, most recent first.
+  Chunk* chunks = nullptr;
+
+  /// The objects to destroy when this arena is destroyed, most recent first.
+  Finalizer* finalizers = nullptr;
+
+  /// The address of the next free byte in the current chunk.
+  std::byte* cursor = nullptr;
+
+  /// The address past the last byte of the current chunk.
+  std::byte* limit = nullptr;
+
+  /// The number of bytes in a regular chunk.
+  std::size_t chunk_size;
+
+  /// Allocates a new chunk capable of storing `s` bytes aligned at `a` and returns the address of
+  /// that storage.
+  void* allocate_slow(std::size_t s, std::size_t a);
+
+public:
+
+  /// Creates an empty instance allocating regular chunks of `chunk_size` bytes.
+  explicit Arena(std::size_t chunk_size = 16 << 10) : chunk_size(chunk_size) {}
+
+  Arena(Arena const&) = delete;
+
+  Arena& operator=(Arena const&) = delete;
+
+  /// Destroys the objects created in `this` and deallocates its memory.
+  ~Arena();
+
+  /// Returns the address of `s` bytes of uninitialized storage aligned at `a`.
+  ///
+  /// - Requires: `a` is a power of two.
+  inline void* allocate(std::size_t s, std::size_t a) {
+    auto p = reinterpret_cast<uintptr_t>(cursor);
+    auto q = (p + (a - 1)) & ~(static_cast<uintptr_t>(a) - 1);
+    if ((cursor != nullptr) && (q + s <= reinterpret_cast<uintptr_t>(limit))) {
+      cursor = reinterpret_cast<std::byte*>(q + s);
+      return reinterpret_cast<void*>(q);
+    } else {
+      return allocate_slow(s, a);
+    }
+  }
+
+  /// Returns `true` iff `p` points into storage allocated by `this`.
+  ///
+  /// The cost of this method is linear in the number of chunks of `this`.
+  bool contains(void const* p) const;
+
+  /// Returns a copy of `elements` allocated in `this`.
+  template<typename T>
+  std::span<T const> copy(std::span<T const> elements) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (elements.empty()) { return {}; }
+    auto p = static_cast<T*>(allocate(elements.size_bytes(), alignof(T)));
+    std::memcpy(p, elements.data(), elements.size_bytes());
+    return {p, elements.size()};
+  }
+
+  /// Returns a new instance of `T` constructed with `arguments` and allocated in `this`.
+  ///
+  /// The instance is destroyed when `this` is destroyed.
+  template<typename T, typename... Arguments>
+  T* create(Arguments&&... arguments) {
+    auto p = new(allocate(sizeof(T), alignof(T))) T(std::forward<Arguments>(arguments)...);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      auto f = static_cast<Finalizer*>(allocate(sizeof(Finalizer), alignof(Finalizer)));
+      f->next = finalizers;
+      f->destroy = [](void* o) { static_cast<T*>(o)->~T(); };
+      f->object = p;
+      finalizers = f;
+    }
+    return p;
+  }
+
+};
+
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "TypeStore.h"
+#include "WitnessTable.h"
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace xst {
+
+/// Storage for a fixed number of instances of a product type, with each field stored in its own
+/// contiguous column.
+///
+/// The `i`-th element of a column holds the value of the corresponding field in the `i`-th row.
+/// Elements of columns whose field is stored out-of-line are pointers to the field's storage, like
+/// in the inline representation of the product type. Columns are aligned at `column_alignment`
+/// and zero-initialized when the buffer is created. The buffer doesn't track which rows are
+/// initialized: any initialized element must be deinitialized before the buffer is destroyed.
+struct ColumnarBuffer {
+
+  /// The alignment of each column.
+  static constexpr std::size_t column_alignment = 64;
+
+  /// Creates an instance with storage for `capacity` instances of `type`, whose metatypes are in
+  /// `store`.
+  ///
+  /// - Requires: `type` has been declared and defined in `store`, and `store` outlives `this`.
+  ColumnarBuffer(TypeStore const& store, StructHeader const* type, std::size_t capacity);
+
+  ColumnarBuffer(ColumnarBuffer const&) = delete;
+
+  ColumnarBuffer& operator=(ColumnarBuffer const&) = delete;
+
+  /// Destroys `this`, deallocating its storage.
+  ~ColumnarBuffer();
+
+  /// Returns the type of the rows in `this`.
+  inline StructHeader const* type() const {
+    return row_type;
+  }
+
+  /// Returns the number of rows in `this`.
+  inline std::size_t capacity() const {
+    return row_count;
+  }
+
+  /// Returns the number of columns in `this`.
+  inline std::size_t column_count() const {
+    return columns.size();
+  }
+
+  /// Returns the number of bytes between two consecutive elements of the `i`-th column.
+  inline std::size_t column_stride(std::size_t i) const {
+    return columns[i].stride;
+  }
+
+  /// Returns the base address of the `i`-th column.
+  inline void* column(std::size_t i) const {
+    return columns[i].base;
+  }
+
+  /// Returns the elements of the `i`-th column.
+  ///
+  /// - Requires: `T` is the native representation of an element of the `i`-th column.
+  template<typename T>
+  inline std::span<T> column(std::size_t i) const {
+    auto const& c = columns[i];
+    if ((c.stride != sizeof(T)) || (c.witnesses->alignment > alignof(T))) {
+      throw std::invalid_argument("bad element type");
+    }
+    return {static_cast<T*>(c.base), row_count};
+  }
+
+  /// Returns the address of the `row`-th element of the `i`-th column.
+  inline void* element_address(std::size_t i, std::size_t row) const {
+    auto const& c = columns[i];
+    return static_cast<std::byte*>(c.base) + row * c.stride;
+  }
+
+  /// Initializes the `count` elements of the `i`-th column starting at `first` with copies of the
+  /// `count` contiguous elements at `source`, laid out by `column_stride(i)`.
+  ///
+  /// - Requires: `first + count` is not greater than `capacity()`.
+  void copy_initialize_column(
+    std::size_t i, std::size_t first, std::size_t count, void const* source);
+
+  /// Destroys the `count` elements of the `i`-th column starting at `first`.
+  ///
+  /// - Requires: `first + count` is not greater than `capacity()`.
+  void deinitialize_column(std::size_t i, std::size_t first, std::size_t count);
+
+  /// Initializes the `row`-th row with a copy of the instance of `type()` stored at `source`.
+  ///
+  /// - Requires: `row` is less than `capacity()`.
+  void copy_initialize_row(std::size_t row, void const* source);
+
+  /// Initializes `target` with a copy of the `row`-th row, as an instance of `type()`.
+  ///
+  /// - Requires: `row` is less than `capacity()` and initialized.
+  void copy_row(std::size_t row, void* target) const;
+
+  /// Destroys the `count` rows starting at `first`.
+  ///
+  /// - Requires: `first + count` is not greater than `capacity()`.
+  void deinitialize(std::size_t first, std::size_t count);
+
+private:
+
+  /// A column.
+  struct Column {
+
+    /// The address of the first element.
+    void* base;
+
+    /// The number of bytes between two consecutive elements.
+    std::size_t stride;
+
+    /// The offset of the corresponding field in an instance of the row type.
+    std::size_t offset;
+
+    /// The witnesses of an element.
+    WitnessTable const* witnesses;
+
+  };
+
+  /// The store containing the metatypes of the row type.
+  TypeStore const& store;
+
+  /// The type of the rows.
+  StructHeader const* row_type;
+
+  /// The number of rows.
+  std::size_t row_count;
+
+  /// The columns.
+  std::vector<Column> columns;
+
+  /// The witnesses of an element of a column whose field is stored out-of-line.
+  struct BoxWitnesses {
+
+    /// The table describing the element.
+    WitnessTable table;
+
+    /// The only operation of `table`.
+    WitnessTable::Operation operation;
+
+  };
+
+  /// The witnesses of the elements of columns whose fields are stored out-of-line.
+  std::vector<std::unique_ptr<BoxWitnesses>> box_witnesses;
+
+  /// The storage of all columns.
+  void* storage = nullptr;
+
+  /// The number of bytes in `storage`.
+  std::size_t storage_size = 0;
+
+};
+
+}
@@ -1,23 +1,39 @@
 #pragma once
 
+#include <cstdint>
+
 namespace xst {
 
 struct TypeHeader;
 
-/// A type identifier and a flag that is set if its instance is stored indirectly.
+/// A type identifier and flags describing how its instance is stored.
 struct Field {
 
-  /// An unowned pointer to a type header and a bit represented by the least significant bit.
+  /// An unowned pointer to a type header and two bits represented by the least significant bits.
+  ///
+  /// The least significant bit is set if the field is stored out-of-line. The next bit is set if
+  /// the out-of-line storage of the field is a reference-counted box that is shared by copies.
   uintptr_t raw_value;
 
   /// Creates an instance with the given properties.
+  ///
+  /// A field that is `shared` is stored out-of-line in a reference-counted box, so that copying
+  /// it only increments a counter. The box is copied the first time it is accessed for writing
+  /// while it is shared.
+  ///
+  /// The pointer stored in an out-of-line field of an initialized value is never null, because
+  /// null may represent a case of an enclosing sum, whose tag is then stored in that niche.
+  /// Storage that is zero-filled and then initialized field by field must allocate every
+  /// out-of-line field (e.g. with `TypeStore::address_of`) before it is used as a payload.
   inline Field(
-    TypeHeader const* type, bool out_of_line = false
-  ) : raw_value(reinterpret_cast<uintptr_t>(type) | out_of_line) {}
+    TypeHeader const* type, bool out_of_line = false, bool shared = false
+  ) : raw_value(
+    reinterpret_cast<uintptr_t>(type) | (out_of_line || shared) | (uintptr_t{shared} << 1)
+  ) {}
 
   /// Returns the type of the field.
   inline TypeHeader const* type() const {
-    return reinterpret_cast<TypeHeader const*>(raw_value & ~1);
+    return reinterpret_cast<TypeHeader const*>(raw_value & ~uintptr_t{0b11});
   }
 
   /// Returns `true` iff the field is stored out-of-line.
@@ -25,6 +41,11 @@ struct Field {
     return (raw_value & 1) != 0;
   }
 
+  /// Returns `true` iff the field is stored out-of-line in a reference-counted box.
+  inline bool shared() const {
+    return (raw_value & 0b10) != 0;
+  }
+
 };
 
 }
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace xst {
+
+/// A set of pointers to unique values, implemented as an open-addressing hash table.
+///
+/// Slots are organized in groups of `group_width` that are probed together. Each slot has a control
+/// byte that is either `empty` or the 7 low bits of the hash of the value that it stores, so that a
+/// probe can compare all the control bytes of a group in parallel and only dereference the values
+/// whose bits match. Values are never removed from the table.
+///
+/// `Hash` is expected to be cheap, as it is called on every stored value when the table grows.
+template<typename T, typename Hash = std::hash<T>, typename Equal = std::equal_to<T>>
+struct InterningTable {
+private:
+
+  /// The number of slots in a group.
+  static constexpr std::size_t group_width = 16;
+
+  /// The control byte of an empty slot.
+  static constexpr uint8_t empty = 0x80;
+
+  /// The control bytes of the slots, or `nullptr` if `capacity` is zero.
+  std::unique_ptr<uint8_t[]> control;
+
+  /// The slots of the table, or `nullptr` if `capacity` is zero.
+  std::unique_ptr<T const*[]> slots;
+
+  /// The number of slots in the table, which is either zero or a power of two multiple of
+  /// `group_width`.
+  std::size_t capacity = 0;
+
+  /// The number of values in the table.
+  std::size_t count = 0;
+
+  /// Returns the group at which the probe sequence of a value with the given hash starts.
+  inline std::size_t first_group(std::size_t hash) const {
+    return (hash >> 7) & (capacity / group_width - 1);
+  }
+
+  /// Returns the control byte of a value with the given hash.
+  static inline uint8_t control_byte(std::size_t hash) {
+    return static_cast<uint8_t>(hash & 0x7f);
+  }
+
+  /// Returns a mask whose `i`-th bit is set iff the `i`-th byte of `group` is equal to `b`.
+  static inline uint32_t match(uint8_t const* group, uint8_t b) {
+#if defined(__SSE2__)
+    auto g = _mm_loadu_si128(reinterpret_cast<__m128i const*>(group));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(b))));
+#else
+    uint32_t result = 0;
+    for (std::size_t i = 0; i < group_width; ++i) {
+      result |= static_cast<uint32_t>(group[i] == b) << i;
+    }
+    return result;
+#endif
+  }
+
+  /// Stores `value`, whose hash is `hash`, in the first empty slot of its probe sequence.
+  ///
+  /// - Requires: the table has at least one empty slot.
+  void place(T const* value, std::size_t hash) {
+    auto g = first_group(hash);
+    for (std::size_t step = 1;; ++step) {
+      auto m = match(control.get() + g * group_width, empty);
+      if (m != 0) {
+        auto i = g * group_width + static_cast<std::size_t>(std::countr_zero(m));
+        control[i] = control_byte(hash);
+        slots[i] = value;
+        return;
+      }
+      g = (g + step) & (capacity / group_width - 1);
+    }
+  }
+
+  /// Reallocates the table with `new_capacity` slots and re-inserts its values.
+  ///
+  /// - Requires: `new_capacity` is a power of two multiple of `group_width` large enough to store
+  ///   the values of the table.
+  void rehash(std::size_t new_capacity) {
+    auto old_control = std::move(control);
+    auto old_slots = std::move(slots);
+    auto old_capacity = capacity;
+
+    control = std::make_unique<uint8_t[]>(new_capacity);
+    slots = std::make_unique<T const*[]>(new_capacity);
+    capacity = new_capacity;
+    std::memset(control.get(), empty, new_capacity);
+
+    for (std::size_t i = 0; i < old_capacity; ++i) {
+      if (old_control[i] != empty) { place(old_slots[i], Hash{}(*old_slots[i])); }
+    }
+  }
+
+public:
+
+  /// Creates an empty instance.
+  InterningTable() = default;
+
+  /// Returns the number of values in the table.
+  inline std::size_t size() const {
+    return count;
+  }
+
+  /// Returns a pointer to the value equal to `value` in the table, or `nullptr` if there is none.
+  inline T const* find(T const& value) const {
+    return find(value, Hash{}(value));
+  }
+
+  /// Returns a pointer to the value equal to `value`, whose hash is `hash`, in the table, or
+  /// `nullptr` if there is none.
+  T const* find(T const& value, std::size_t hash) const {
+    if (count == 0) { return nullptr; }
+
+    auto g = first_group(hash);
+    auto h = control_byte(hash);
+    for (std::size_t step = 1;; ++step) {
+      auto group = control.get() + g * group_width;
+      for (auto m = match(group, h); m != 0; m &= m - 1) {
+        auto p = slots[g * group_width + static_cast<std::size_t>(std::countr_zero(m))];
+        if (Equal{}(*p, value)) { return p; }
+      }
+      if (match(group, empty) != 0) { return nullptr; }
+      g = (g + step) & (capacity / group_width - 1);
+    }
+  }
+
+  /// Hints that the value whose hash is `hash` is about to be looked up.
+  ///
+  /// This method fetches the first group probed by `find` into the cache so that the latency of
+  /// several lookups can be overlapped.
+  inline void prefetch(std::size_t hash) const {
+#if defined(__GNUC__)
+    if (capacity == 0) { return; }
+    auto g = first_group(hash) * group_width;
+    __builtin_prefetch(control.get() + g);
+    __builtin_prefetch(slots.get() + g);
+#endif
+  }
+
+  /// Inserts `value` into the table.
+  ///
+  /// - Requires: the table doesn't contain any value equal to `*value`.
+  inline void insert(T const* value) {
+    insert(value, Hash{}(*value));
+  }
+
+  /// Inserts `value`, whose hash is `hash`, into the table.
+  ///
+  /// - Requires: the table doesn't contain any value equal to `*value`.
+  void insert(T const* value, std::size_t hash) {
+    reserve(count + 1);
+    place(value, hash);
+    ++count;
+  }
+
+  /// Ensures that the table can store `n` values without allocating new storage.
+  void reserve(std::size_t n) {
+    // The table is kept at most 7/8 full so that every probe sequence ends on an empty slot.
+    if (n * 8 <= capacity * 7) { return; }
+    auto c = std::max(capacity, group_width);
+    while (n * 8 > c * 7) { c *= 2; }
+    rehash(c);
+  }
+
+};
+
+/// A set of pointers to unique values, which can be searched without locking while values are
+/// inserted by one thread at a time.
+///
+/// Slots are probed in the same order as in `InterningTable`, but each slot is only assigned once,
+/// with release semantics, and the table is replaced by a copy rather than rehashed in place when
+/// it grows. Hence, a search racing with an insertion either sees the new value or misses it, in
+/// which case it can be repeated while holding the lock serializing insertions. Values are never
+/// removed from the table and the replaced tables are kept until the set is destroyed, as searches
+/// may still be probing them.
+///
+/// `Hash` is expected to be cheap, as it is called on every stored value when the table grows.
+template<typename T, typename Hash = std::hash<T>, typename Equal = std::equal_to<T>>
+struct ConcurrentInterningTable {
+private:
+
+  /// The slots of a table, each of which is either `nullptr` or a value.
+  struct Slots {
+
+    /// The number of slots, which is a power of two.
+    std::size_t capacity;
+
+    /// The slots.
+    std::unique_ptr<std::atomic<T const*>[]> values;
+
+  };
+
+  /// The current slots of the table, or `nullptr` if no value has been inserted.
+  std::atomic<Slots const*> current{nullptr};
+
+  /// All the slots allocated by the table, the last of which are `current`.
+  std::vector<std::unique_ptr<Slots>> allocated;
+
+  /// The number of values in the table.
+  std::size_t count = 0;
+
+  /// Stores `value`, whose hash is `hash`, in the first empty slot of its probe sequence in `s`.
+  ///
+  /// - Requires: `s` has at least one empty slot.
+  static void place(Slots const& s, T const* value, std::size_t hash) {
+    auto mask = s.capacity - 1;
+    for (std::size_t i = hash & mask, step = 1;; i = (i + step) & mask, ++step) {
+      if (s.values[i].load(std::memory_order_relaxed) == nullptr) {
+        s.values[i].store(value, std::memory_order_release);
+        return;
+      }
+    }
+  }
+
+public:
+
+  /// Creates an empty instance.
+  ConcurrentInterningTable() = default;
+
+  /// Returns a pointer to the value equal to `value`, whose hash is `hash`, in the table, or
+  /// `nullptr` if there is none or if it is being inserted concurrently.
+  T const* find(T const& value, std::size_t hash) const {
+    auto s = current.load(std::memory_order_acquire);
+    if (s == nullptr) { return nullptr; }
+
+    auto mask = s->capacity - 1;
+    for (std::size_t i = hash & mask, step = 1;; i = (i + step) & mask, ++step) {
+      auto p = s->values[i].load(std::memory_order_acquire);
+      if (p == nullptr) { return nullptr; }
+      if (Equal{}(*p, value)) { return p; }
+    }
+  }
+
+  /// Inserts `value`, whose hash is `hash`, into the table.
+  ///
+  /// - Requires: the table doesn't contain any value equal to `*value` and no other thread is
+  ///   inserting a value into the table.
+  void insert(T const* value, std::size_t hash) {
+    auto s = current.load(std::memory_order_relaxed);
+
+    // The table is kept at most 7/8 full so that every probe sequence ends on an empty slot.
+    if ((s == nullptr) || ((count + 1) * 8 > s->capacity * 7)) {
+      auto c = (s == nullptr) ? std::size_t{16} : s->capacity * 2;
+      auto t = std::make_unique<Slots>(Slots{c, std::make_unique<std::atomic<T const*>[]>(c)});
+      if (s != nullptr) {
+        for (std::size_t i = 0; i < s->capacity; ++i) {
+          auto p = s->values[i].load(std::memory_order_relaxed);
+          if (p != nullptr) { place(*t, p, Hash{}(*p)); }
+        }
+      }
+      s = t.get();
+      allocated.push_back(std::move(t));
+    }
+
+    place(*s, value, hash);
+    ++count;
+    current.store(s, std::memory_order_release);
+  }
+
+};
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "TypeHeader.h"
+#include "WitnessTable.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xst {
+
+/// A table of bulk operations on contiguous buffers, implemented with a specific instruction set.
+///
+/// All implementations compute the same results, so that hashes don't depend on the CPU on which
+/// they are computed. Use `native` to get the implementation best suited to the executing CPU.
+struct Kernels {
+
+  /// An instruction set used to implement kernels.
+  enum InstructionSet : uint8_t {
+
+    /// Portable scalar code.
+    portable,
+
+    /// SSE2 on x86-64.
+    sse2,
+
+    /// AVX2 on x86-64.
+    avx2,
+
+    /// AVX-512 (F and BW) on x86-64.
+    avx512,
+
+    /// NEON on AArch64.
+    neon,
+
+  };
+
+  /// The number of bytes consumed by one step of `accumulate`.
+  static constexpr std::size_t stripe_size = 32;
+
+  /// The instruction set used by these kernels.
+  InstructionSet instruction_set;
+
+  /// Writes `count` copies of the `width` bytes at `value` contiguously at `target`.
+  void (*fill)(void* target, void const* value, std::size_t width, std::size_t count);
+
+  /// Returns `true` iff the `n` bytes at `a` are equal to the `n` bytes at `b`.
+  bool (*equal)(void const* a, void const* b, std::size_t n);
+
+  /// Mixes the `count` stripes of `stripe_size` bytes at `p` into the four `lanes`.
+  void (*accumulate)(uint64_t* lanes, void const* p, std::size_t count);
+
+  /// Returns a hash of the `n` bytes at `p`, seeded with `seed`.
+  uint64_t hash(void const* p, std::size_t n, uint64_t seed = 0) const;
+
+  /// Returns the kernels best suited to the executing CPU.
+  static Kernels const& native();
+
+  /// Returns the kernels implemented with `s`, or `nullptr` if `s` is not supported by the
+  /// executing CPU or by the compiler.
+  static Kernels const* with(InstructionSet s);
+
+};
+
+/// Writes `count` copies of the instance of `type` at `value` contiguously at `target`.
+void fill_n(BuiltinHeader::Value type, void* target, void const* value, std::size_t count);
+
+/// Initializes the `count` contiguous instances of `type` at `target` with copies of the `count`
+/// contiguous instances at `source`.
+void copy_n(BuiltinHeader::Value type, void* target, void const* source, std::size_t count);
+
+/// Returns `true` iff the `count` contiguous instances of `type` at `a` are equal to those at `b`.
+bool equal_n(BuiltinHeader::Value type, void const* a, void const* b, std::size_t count);
+
+/// Returns a hash of the `count` contiguous instances of `type` at `p`.
+uint64_t hash_n(BuiltinHeader::Value type, void const* p, std::size_t count);
+
+/// Returns `true` iff the `count` contiguous instances described by `witnesses` at `a` are equal
+/// to those at `b`.
+///
+/// - Requires: `witnesses.bitwise_equatable` holds.
+bool equal_n(WitnessTable const& witnesses, void const* a, void const* b, std::size_t count);
+
+/// Returns a hash of the `count` contiguous instances described by `witnesses` at `p`.
+///
+/// - Requires: `witnesses.bitwise_equatable` holds.
+uint64_t hash_n(WitnessTable const& witnesses, void const* p, std::size_t count);
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "TypeStore.h"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+namespace xst {
+
+template<typename Signature>
+struct Lambda;
+
+/// The binding of a lambda type of some store, declared by `TypeStore::declare_lambda`, to
+/// native types for the result `R`, the environment `E`, and the parameters `P` of its API.
+///
+/// The function stored in a lambda follows the calling convention of the store. It receives the
+/// addresses of the result, of the environment, and of each argument, so that its type is
+/// `void(R*, E*, P*...)`. A binding checks the layout of the lambda type once, when it is created,
+/// so that calls don't look up the metatype of the lambda.
+///
+/// - Note: Every call goes through the stored function, which receives its arguments by address
+///   rather than in registers. Only the functions created by `implement` avoid a second indirect
+///   call, because the native function that they adapt is inlined in the adapter. No thunk
+///   passing arguments in registers is cached for a lambda type: recognizing such a thunk costs a
+///   load and a comparison on every call, which is more than the stores and loads of arguments
+///   passed by address, as measured by the `call_lambda` benchmark.
+template<typename R, typename E, typename... P>
+struct Lambda<R(E, P...)> {
+
+  static_assert(
+    std::is_trivially_copyable_v<R> && std::is_trivially_copyable_v<E> &&
+    (std::is_trivially_copyable_v<P> && ...),
+    "the API of a lambda must be represented by trivially copyable types");
+
+  /// The type of the functions stored in lambdas.
+  using Function = void(*)(R*, E*, P*...);
+
+  /// The type through which a function created by `implement` receives the environment.
+  ///
+  /// Environments that fit in a pointer are passed by value, so that they are kept in registers.
+  using Environment = std::conditional_t<(sizeof(E) <= sizeof(void*)), E, E const&>;
+
+  /// The type of the functions that can be adapted to the calling convention of the store.
+  using NativeFunction = R(*)(Environment, P...);
+
+  /// Creates an instance binding the lambda type `type` of `store`, or throws if the API of
+  /// `type` isn't represented by `R`, `E`, and `P`.
+  ///
+  /// A type of the API is represented by a native type of the same size and of a weaker or equal
+  /// alignment. The types of the API must be trivial, since their instances are copied bitwise.
+  ///
+  /// - Requires: `type` has been returned by `store.declare_lambda`.
+  Lambda(TypeStore const& store, StructHeader const* type) {
+    auto const& m = store[type];
+    auto api = type->arguments;
+    auto represents = [&]<typename T>(TypeHeader const* t, T*) {
+      return (store.size(t) == sizeof(T)) && (store.alignment(t) >= alignof(T))
+        && store.is_trivial(t);
+    };
+    auto api_match = (api.size() == 2 + sizeof...(P));
+    if (api_match) {
+      std::size_t i = 2;
+      api_match =
+        represents(api[0], static_cast<E*>(nullptr)) &&
+        represents(api[1], static_cast<R*>(nullptr)) &&
+        (represents(api[i++], static_cast<P*>(nullptr)) && ...);
+    }
+    if ((std::string_view{type->name} != "$fun") || !api_match) {
+      throw std::invalid_argument(type->description() + " doesn't have the expected API");
+    }
+    function_offset = store.offset(m, 0);
+    environment_offset = store.offset(m, 1);
+  }
+
+  /// Returns a function following the calling convention of the store that calls `function`.
+  template<NativeFunction function>
+  static Function implement() {
+    return [](R* result, E* environment, P*... arguments) {
+      *result = function(*environment, *arguments...);
+    };
+  }
+
+  /// Initializes the lambda at `target` with `function` and a copy of `environment`.
+  ///
+  /// - Requires: `target` is the address of storage for an instance of the bound type.
+  inline void initialize(void* target, Function function, E const& environment) const {
+    auto t = static_cast<std::byte*>(target);
+    auto f = reinterpret_cast<AnyFunction>(function);
+    std::memcpy(t + function_offset, &f, sizeof(AnyFunction));
+    std::memcpy(t + environment_offset, &environment, sizeof(E));
+  }
+
+  /// Returns the environment of the lambda at `source`.
+  ///
+  /// - Requires: `source` is the address of an instance of the bound type.
+  inline E* environment(void* source) const {
+    return reinterpret_cast<E*>(static_cast<std::byte*>(source) + environment_offset);
+  }
+
+  /// Calls the lambda at `source` with `arguments` and returns its result.
+  ///
+  /// - Requires: `source` is the address of an instance of the bound type.
+  inline R operator()(void* source, P... arguments) const {
+    AnyFunction f;
+    std::memcpy(&f, static_cast<std::byte*>(source) + function_offset, sizeof(AnyFunction));
+    alignas(R) std::array<std::byte, sizeof(R)> result;
+    reinterpret_cast<Function>(f)(
+      reinterpret_cast<R*>(result.data()), environment(source), &arguments...);
+    return std::bit_cast<R>(result);
+  }
+
+private:
+
+  /// The offset of the function in a lambda.
+  std::size_t function_offset;
+
+  /// The offset of the environment in a lambda.
+  std::size_t environment_offset;
+
+};
+
+}
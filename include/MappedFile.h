@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+
+namespace xst {
+
+/// The contents of a file mapped read-only in memory.
+///
+/// The file is mapped with `mmap` on POSIX systems, so that its pages are only loaded when they
+/// are accessed and shared with the other processes mapping the same file. It is read into a
+/// buffer on other systems.
+struct MappedFile {
+
+  /// Maps the contents of the file at `path`, or throws an exception if it can't be read.
+  explicit MappedFile(char const* path);
+
+  MappedFile(MappedFile const&) = delete;
+
+  MappedFile& operator=(MappedFile const&) = delete;
+
+  /// Unmaps the contents of the file.
+  ~MappedFile();
+
+  /// Returns the contents of the file.
+  inline std::span<std::byte const> contents() const {
+    return {base, size};
+  }
+
+private:
+
+  /// The address of the contents of the file, or `nullptr` if it is empty.
+  std::byte const* base = nullptr;
+
+  /// The size of the file.
+  std::size_t size = 0;
+
+};
+
+}
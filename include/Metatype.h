@@ -1,6 +1,8 @@
 #pragma once
 
+#include "Arena.h"
 #include "Field.h"
+#include "TagEncoding.h"
 
 #include <span>
 #include <vector>
@@ -11,39 +13,113 @@ namespace xst {
 struct Metatype {
 private:
 
+  /// The size of a cache line, at which payloads are aligned.
+  static constexpr std::size_t payload_alignment = 64;
+
+  /// The properties of a metatype that are stored before its fields and their offsets.
+  struct alignas(payload_alignment) Header {
+
+    /// The size of an instance.
+    std::size_t size;
+
+    /// The alignment of an instance.
+    std::size_t alignment;
+
+    /// The number of bytes from the start of one instance to the start of the next when stored
+    /// in contiguous memory.
+    std::size_t stride;
+
+    /// The number of fields.
+    std::size_t field_count;
+
+    /// The way the case of an instance is represented if the type is a sum.
+    TagEncoding tag;
+
+    /// `true` iff the type doesn't involve out-of-line storage.
+    bool is_trivial;
+
+    /// `true` iff the inline representation of an instance has no padding or spare bits.
+    bool is_dense;
+
+    /// `true` iff at least one of the fields is stored out-of-line.
+    bool has_out_of_line_fields;
+
+  };
+
+  static_assert(sizeof(Header) == payload_alignment);
+
+  /// The representation of this instance.
+  ///
+  /// The representation is the address of a payload, laid out as a header followed by the fields
+  /// and then their offsets, or zero if the metatype is undefined. The least significant bit is
+  /// set iff the payload is not owned by this instance.
   uintptr_t data;
 
-  /// Returns a pointer to this instance's payload iff it is defined and stored stored out-of-line.
-  /// Otherwise, returns `nullptr`.
-  inline std::size_t* base_address() const {
-    return ((data == 0) || (data & 1)) ? nullptr : reinterpret_cast<std::size_t*>(data & ~0b11);
+  /// Returns the header of this instance's payload.
+  ///
+  /// - Requires: `this` is defined.
+  inline Header const* header() const {
+    return reinterpret_cast<Header const*>(data & ~(payload_alignment - 1));
   }
 
+  /// Deallocates the payload of this instance if it is owned.
+  inline void release() {
+    if ((data != 0) && ((data & 1) == 0)) {
+      ::operator delete(
+        reinterpret_cast<void*>(data), std::align_val_t{payload_alignment});
+    }
+  }
+
+  /// Initializes this instance with the given properties, allocating its payload of `n` bytes with
+  /// `allocate(n)`.
+  template<typename Allocate>
+  void initialize(
+    std::size_t size, std::size_t alignment, bool is_trivial, bool is_dense,
+    std::span<Field const> fields,
+    std::span<std::size_t const> offsets,
+    TagEncoding tag,
+    Allocate allocate);
+
 public:
 
   Metatype() : data(0) {};
 
+  /// Creates an instance with the given properties.
+  ///
+  /// The instance is considered not dense, as that property depends on the types of its fields.
   Metatype(
     std::size_t size, std::size_t alignment, bool is_trivial,
     std::vector<Field>&& fields,
-    std::vector<std::size_t>&& offsets
+    std::vector<std::size_t>&& offsets,
+    TagEncoding tag = {}
+  );
+
+  /// Creates an instance with the given properties, allocating its payload in `arena`.
+  ///
+  /// The payload of the new instance is deallocated when `arena` is destroyed.
+  Metatype(
+    std::size_t size, std::size_t alignment, bool is_trivial, bool is_dense,
+    std::span<Field const> fields,
+    std::span<std::size_t const> offsets,
+    TagEncoding tag,
+    Arena& arena
   );
 
   Metatype(Metatype const&) = delete;
 
   Metatype& operator=(Metatype const&)= delete;
 
-  Metatype(Metatype&& other) : data(other.data) { other.data = 0; }
+  Metatype(Metatype&& other) noexcept : data(other.data) { other.data = 0; }
 
-  Metatype& operator=(Metatype&& other) {
-    delete base_address();
+  Metatype& operator=(Metatype&& other) noexcept {
+    release();
     this->data = other.data;
     other.data = 0;
     return *this;
   }
 
   ~Metatype() {
-    delete base_address();
+    release();
   }
 
   /// Returns `true` if this instance is defined.
@@ -51,63 +127,72 @@ public:
     return data != 0;
   }
 
-  /// Returns `true` iff none of the describe type does not contain out-of-line storage.
+  /// Returns `true` iff the described type doesn't involve out-of-line storage.
   ///
   /// - Requires: `this` is defined.
   inline bool is_trivial() const {
-    return (data & 0b10) != 0;
+    return header()->is_trivial;
+  }
+
+  /// Returns `true` iff the inline representation of an instance has no padding or spare bits, so
+  /// that two instances are equal if and only if their representations are bitwise equal.
+  ///
+  /// - Requires: `this` is defined.
+  inline bool is_dense() const {
+    return header()->is_dense;
+  }
+
+  /// Returns `true` iff at least one of the fields of the described type is stored out-of-line.
+  ///
+  /// - Requires: `this` is defined.
+  inline bool has_out_of_line_fields() const {
+    return header()->has_out_of_line_fields;
   }
 
   /// Returns the size of the described type.
   ///
   /// - Requires: `this` is defined.
   inline std::size_t size() const {
-    auto base = base_address();
-    if (base == nullptr) {
-      return static_cast<std::size_t>((data >> 32) & 0xffff);
-    } else {
-      return base[0];
-    }
+    return header()->size;
   }
 
   /// Returns the alignment of the described type.
   ///
   /// - Requires: `this` is defined.
   inline std::size_t alignment() const {
-    auto base = base_address();
-    if (base == nullptr) {
-      return static_cast<std::size_t>((data >> 16) & 0xffff);
-    } else {
-      return base[1];
-    }
+    return header()->alignment;
+  }
+
+  /// Returns the number of bytes from the start of one instance to the start of the next when
+  /// stored in contiguous memory.
+  ///
+  /// - Requires: `this` is defined.
+  inline std::size_t stride() const {
+    return header()->stride;
   }
 
   /// Returns the fields of the described type, if any.
   ///
   /// - Requires: `this` is defined.
-  std::span<Field const> fields() const {
-    auto base = base_address();
-    if (base == nullptr) {
-      return std::span<Field const>{};
-    } else {
-      auto s = base[2];
-      auto b = static_cast<Field const*>(static_cast<void*>(base + 3));
-      return std::span<Field const>{b, s};
-    }
+  inline std::span<Field const> fields() const {
+    auto h = header();
+    return {reinterpret_cast<Field const*>(h + 1), h->field_count};
+  }
+
+  /// Returns the way the case of an instance is represented if the described type is a sum.
+  ///
+  /// - Requires: `this` is defined.
+  inline TagEncoding const& tag_encoding() const {
+    return header()->tag;
   }
 
   /// Returns the offsets of the described type, if any.
   ///
   /// - Requires: `this` is defined.
-  std::span<std::size_t> offsets() const {
-    auto base = base_address();
-    if (base == nullptr) {
-      return std::span<std::size_t>{};
-    } else {
-      auto s = base[2];
-      auto b = base + 3 + s;
-      return std::span<std::size_t>{b, s};
-    }
+  inline std::span<std::size_t const> offsets() const {
+    auto h = header();
+    auto b = reinterpret_cast<std::size_t const*>(h + 1) + h->field_count;
+    return {b, h->field_count};
   }
 
 };
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace xst {
+
+/// A growable buffer of characters to which textual representations are appended.
+struct OutputBuffer {
+
+  /// The characters written so far.
+  std::string contents;
+
+  /// Creates an empty instance.
+  OutputBuffer() = default;
+
+  /// Returns the characters written so far.
+  inline std::string_view view() const {
+    return contents;
+  }
+
+  /// Appends `c`.
+  inline void append(char c) {
+    contents.push_back(c);
+  }
+
+  /// Appends `s`.
+  inline void append(std::string_view s) {
+    contents.append(s);
+  }
+
+  /// Appends the decimal representation of `value`.
+  template<typename T>
+  inline void append_integer(T value) {
+    static_assert(std::is_integral_v<T>);
+    char b[24];
+    auto r = std::to_chars(b, b + sizeof(b), value);
+    contents.append(b, r.ptr);
+  }
+
+  /// Appends the hexadecimal representation of `value`, prefixed by "0x".
+  inline void append_address(uintptr_t value) {
+    char b[2 + 2 * sizeof(uintptr_t)] = {'0', 'x'};
+    auto r = std::to_chars(b + 2, b + sizeof(b), value, 16);
+    contents.append(b, r.ptr);
+  }
+
+};
+
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace xst {
+
+/// A per-thread stack of memory from which temporary buffers are allocated and released in LIFO
+/// order.
+///
+/// Memory is carved out of blocks of `block_size` bytes that are kept for the lifetime of the
+/// thread, so that nested temporaries are served without calling into the global heap once the
+/// stack has reached its high-water mark.
+struct ScratchArena {
+
+  /// The number of bytes in a block.
+  static constexpr std::size_t block_size = 64 << 10;
+
+  /// The position of the top of the stack.
+  struct Mark {
+
+    /// The index of the block containing the top of the stack.
+    std::size_t block;
+
+    /// The address of the top of the stack, or `nullptr` if `block` hasn't been used yet.
+    std::byte* cursor;
+
+  };
+
+  /// Creates an empty instance.
+  ScratchArena() = default;
+
+  ScratchArena(ScratchArena const&) = delete;
+
+  ScratchArena& operator=(ScratchArena const&) = delete;
+
+  /// Destroys `this`, deallocating its blocks.
+  ~ScratchArena();
+
+  /// Returns the scratch arena of the calling thread.
+  static inline ScratchArena& local() {
+    thread_local ScratchArena instance;
+    return instance;
+  }
+
+  /// Returns the current position of the top of the stack.
+  inline Mark mark() const {
+    return {current, cursor};
+  }
+
+  /// Releases all the storage allocated since `m` was returned by `mark`.
+  ///
+  /// - Requires: `m` was returned by `mark` and storage is released in LIFO order.
+  inline void reset(Mark m) {
+    current = m.block;
+    cursor = m.cursor;
+    limit = (cursor != nullptr) ? blocks[current] + block_size : nullptr;
+  }
+
+  /// Returns the address of `s` bytes of uninitialized storage aligned at `a`.
+  ///
+  /// - Requires: `a` is a power of two and `s + a` is not greater than `block_size`.
+  inline void* allocate(std::size_t s, std::size_t a) {
+    auto p = reinterpret_cast<uintptr_t>(cursor);
+    auto q = (p + (a - 1)) & ~(static_cast<uintptr_t>(a) - 1);
+    if ((cursor != nullptr) && (q + s <= reinterpret_cast<uintptr_t>(limit))) {
+      cursor = reinterpret_cast<std::byte*>(q + s);
+      return reinterpret_cast<void*>(q);
+    } else {
+      return allocate_slow(s, a);
+    }
+  }
+
+private:
+
+  /// The blocks allocated by this instance.
+  std::vector<std::byte*> blocks;
+
+  /// The index of the block containing the top of the stack.
+  std::size_t current = 0;
+
+  /// The address of the top of the stack, or `nullptr` if `current` hasn't been used yet.
+  std::byte* cursor = nullptr;
+
+  /// The address past the last byte of the current block.
+  std::byte* limit = nullptr;
+
+  /// Moves the top of the stack to the next block and allocates `s` bytes aligned at `a` there.
+  void* allocate_slow(std::size_t s, std::size_t a);
+
+};
+
+/// Uninitialized storage for temporary values, released when the instance is destroyed.
+///
+/// Buffers of up to `scratch_threshold` bytes are allocated in the scratch arena of the calling
+/// thread. Larger ones are allocated on the heap.
+struct TemporaryBuffer {
+
+  /// The largest number of bytes (alignment padding included) served by scratch arenas.
+  static constexpr std::size_t scratch_threshold = ScratchArena::block_size / 4;
+
+  /// Creates an instance with storage for `size` bytes aligned at `alignment`.
+  ///
+  /// - Requires: `size` is greater than zero and `alignment` is a power of two.
+  inline TemporaryBuffer(std::size_t size, std::size_t alignment) {
+    if (size + alignment <= scratch_threshold) {
+      arena = &ScratchArena::local();
+      mark = arena->mark();
+      base = arena->allocate(size, alignment);
+    } else {
+      this->alignment = alignment;
+      base = ::operator new(size, std::align_val_t{alignment});
+    }
+  }
+
+  TemporaryBuffer(TemporaryBuffer const&) = delete;
+
+  TemporaryBuffer& operator=(TemporaryBuffer const&) = delete;
+
+  /// Releases the storage of `this`.
+  inline ~TemporaryBuffer() {
+    if (arena != nullptr) {
+      arena->reset(mark);
+    } else {
+      ::operator delete(base, std::align_val_t{alignment});
+    }
+  }
+
+  /// Returns the address of the storage of `this`.
+  inline void* address() const {
+    return base;
+  }
+
+private:
+
+  /// The address of the storage of `this`.
+  void* base;
+
+  /// The arena in which `this` is allocated, or `nullptr` if `this` is allocated on the heap.
+  ScratchArena* arena = nullptr;
+
+  /// The top of `arena` before `this` was allocated.
+  ScratchArena::Mark mark;
+
+  /// The alignment of the storage of `this`, if it is allocated on the heap.
+  std::size_t alignment = 0;
+
+};
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "TypeStore.h"
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace xst {
+
+// The binary representation of an instance, called an image, starts with the inline
+// representation of that instance. The storage of each out-of-line part follows, aligned at the
+// alignment of its type relative to the start of the image, and the pointer to that storage is
+// replaced by the signed offset from the pointer's own position to the part, which is always
+// positive. Null pointers, which represent cases stored in niches, are written as zero. A shared
+// box referred to several times is written once.
+//
+// Instances of `ptr` and `fun` are written bitwise and are only meaningful in the process that
+// wrote them.
+
+/// Returns the image of the instance of `type` stored at `source`.
+///
+/// - Requires: `type` has been declared and defined in `store` and `source` is initialized.
+std::vector<std::byte> serialize(TypeStore const& store, TypeHeader const* type, void* source);
+
+/// Initializes `target` with the instance of `type` whose image is `image`, allocating its
+/// out-of-line storage with the value allocator of `store`.
+///
+/// The image is validated before any storage is allocated and an exception is thrown if it isn't
+/// the image of an instance of `type`, in which case `target` is left uninitialized.
+///
+/// - Requires: `type` has been declared and defined in `store` with the same layout as in the
+///   store of the instance from which `image` has been created.
+void deserialize(
+  TypeStore const& store, TypeHeader const* type, void* target, std::span<std::byte const> image);
+
+/// A read-only view of an instance of a type in its image.
+///
+/// Parts are read in place, without copying the image or allocating any storage.
+struct SerializedValue {
+
+  /// Creates a view of the instance of `type` whose image is `image`.
+  ///
+  /// An exception is thrown if `image` isn't the image of an instance of `type` or if its address
+  /// isn't aligned at `alignof(std::max_align_t)`.
+  ///
+  /// - Requires: `type` has been declared and defined in `store` with the same layout as in the
+  ///   store of the instance from which `image` has been created, and `image` outlives `this`.
+  SerializedValue(TypeStore const& store, TypeHeader const* type, std::span<std::byte const> image);
+
+  /// Returns the type of the instance.
+  inline TypeHeader const* type() const {
+    return root_type;
+  }
+
+  /// Returns the address of the inline representation of the instance.
+  inline void const* base() const {
+    return image.data();
+  }
+
+  /// Returns the address of the `i`-th field of the part of the image at `base`, whose type is
+  /// described by `m`.
+  ///
+  /// - Requires: `base` is the address of an instance described by `m` in the image, and `i` is
+  ///   less than the number of fields in `m`.
+  void const* address_of(Metatype const& m, std::size_t i, void const* base) const;
+
+  /// Returns the address of the `i`-th field of the part of the image at `base`, which is an
+  /// instance of `type`.
+  ///
+  /// - Requires: `base` is the address of an instance of `type` in the image, and `i` is less
+  ///   than the number of fields in an instance of `type`.
+  inline void const* address_of(TypeHeader const* type, std::size_t i, void const* base) const {
+    return address_of(store[type], i, base);
+  }
+
+private:
+
+  /// The store containing the metatypes of the parts of the instance.
+  TypeStore const& store;
+
+  /// The type of the instance.
+  TypeHeader const* root_type;
+
+  /// The image of the instance.
+  std::span<std::byte const> image;
+
+};
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace xst {
+
+/// Counters of the events occurring in a type store, broken down by type.
+///
+/// Each thread counts events in a table that only it writes, so that recording an event doesn't
+/// synchronize with other threads. Tables are aggregated on demand. Statistics are only recorded
+/// by type stores if `XST_STATISTICS` is defined.
+struct Statistics {
+
+  /// An event counted by statistics.
+  enum Event : uint8_t {
+
+    /// A type was declared and found to be already interned.
+    declare_hit,
+
+    /// A type was declared and interned.
+    declare_miss,
+
+    /// The metatype of a type was looked up.
+    metatype_lookup,
+
+    /// Out-of-line storage was allocated for an instance of a type.
+    box_allocation,
+
+    /// Bytes of out-of-line storage were allocated for instances of a type.
+    allocated_bytes,
+
+    /// An instance of a type was copied, either inline or out-of-line.
+    copied_node,
+
+    /// Out-of-line storage of an instance of a type was deallocated.
+    deallocation,
+
+  };
+
+  /// The number of distinct events.
+  static constexpr std::size_t event_count = deallocation + 1;
+
+  /// The number of occurrences of each event.
+  using Counts = std::array<std::uint64_t, event_count>;
+
+  /// Returns the name of `e`.
+  static char const* name(Event e);
+
+  /// Creates an instance without any counts.
+  Statistics();
+
+  Statistics(Statistics const&) = delete;
+
+  Statistics& operator=(Statistics const&) = delete;
+
+  /// Destroys `this`.
+  ~Statistics();
+
+  /// Records `n` occurrences of `e` on the type whose ID is `type` in the table of the calling
+  /// thread.
+  void record(Event e, std::size_t type, std::uint64_t n = 1);
+
+  /// Returns the counts of each type, indexed by ID, aggregated over all threads.
+  ///
+  /// Events recorded concurrently may or may not be counted.
+  std::vector<Counts> snapshot() const;
+
+private:
+
+  /// The number of types in the first segment of a table.
+  static constexpr std::size_t first_segment_size = 64;
+
+  /// The maximum number of segments in a table.
+  static constexpr std::size_t segment_count = 32;
+
+  /// The counts of one type in a table.
+  using Row = std::array<std::atomic<std::uint64_t>, event_count>;
+
+  /// The counts recorded by one thread.
+  ///
+  /// Rows are allocated in segments, the `k`-th segment containing `first_segment_size << k`
+  /// rows, so that they never move once allocated.
+  struct Table {
+
+    /// The segments of the table.
+    std::array<std::atomic<Row*>, segment_count> segments{};
+
+    /// Destroys `this` and its segments.
+    ~Table();
+
+  };
+
+  /// A number identifying this instance uniquely for the lifetime of the program.
+  std::uint64_t identity;
+
+  /// The lock protecting `tables`.
+  mutable std::mutex mutex;
+
+  /// The tables of the threads that recorded events in this instance.
+  std::vector<std::unique_ptr<Table>> tables;
+
+  /// Returns the table of the calling thread.
+  Table& local_table();
+
+};
+
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace xst {
+
+/// The way the case of an instance of a sum type is represented.
+///
+/// The case is stored either in a dedicated tag or in a niche, which is a part of the payload of
+/// one case whose type has values that are never taken by its valid instances. In the latter form,
+/// the cases other than `payload_case` have no payload and are represented by consecutive spare
+/// values of the niche starting at `niche_start`, in order.
+struct TagEncoding {
+
+  /// The offset of the bytes representing the case.
+  uint32_t offset = 0;
+
+  /// The first spare value of the niche, if the case is stored in a niche.
+  uint32_t niche_start = 0;
+
+  /// The case whose payload contains the niche, if the case is stored in a niche.
+  uint16_t payload_case = 0;
+
+  /// The number of spare values of the niche representing cases, or zero if the case is stored in
+  /// a dedicated tag.
+  uint16_t niche_count = 0;
+
+  /// The number of bytes representing the case, or zero if the type has less than two cases.
+  ///
+  /// A dedicated tag is as narrow as the number of cases allows and aligned at its width.
+  uint8_t width = 0;
+
+  /// Returns the number of bytes of a dedicated tag representing `count` cases.
+  ///
+  /// - Requires: `count` is greater than one.
+  static constexpr uint8_t tag_width(std::size_t count) {
+    if (count <= (std::size_t{1} << 8)) {
+      return 1;
+    } else if (count <= (std::size_t{1} << 16)) {
+      return 2;
+    } else {
+      return 4;
+    }
+  }
+
+  /// Returns `true` iff the case is stored in a niche.
+  inline bool uses_niche() const {
+    return niche_count != 0;
+  }
+
+  /// Returns the unsigned integer of `width` bytes stored at `p`.
+  static inline uint64_t load(void const* p, std::size_t width) {
+    switch (width) {
+      case 1: { uint8_t x; std::memcpy(&x, p, 1); return x; }
+      case 2: { uint16_t x; std::memcpy(&x, p, 2); return x; }
+      case 4: { uint32_t x; std::memcpy(&x, p, 4); return x; }
+      default: { uint64_t x; std::memcpy(&x, p, 8); return x; }
+    }
+  }
+
+  /// Stores `value` as an unsigned integer of `width` bytes at `p`.
+  static inline void store(void* p, std::size_t width, uint64_t value) {
+    switch (width) {
+      case 1: { auto x = static_cast<uint8_t>(value); std::memcpy(p, &x, 1); break; }
+      case 2: { auto x = static_cast<uint16_t>(value); std::memcpy(p, &x, 2); break; }
+      case 4: { auto x = static_cast<uint32_t>(value); std::memcpy(p, &x, 4); break; }
+      default: { std::memcpy(p, &value, 8); break; }
+    }
+  }
+
+  /// Returns the case of the instance at `base`.
+  inline std::size_t case_of(void const* base) const {
+    if (width == 0) { return 0; }
+    auto v = load(static_cast<std::byte const*>(base) + offset, width);
+    if (niche_count == 0) { return static_cast<std::size_t>(v); }
+
+    // Values outside of the niche are taken by instances of the payload case.
+    auto r = v - niche_start;
+    if (r >= niche_count) { return payload_case; }
+    return (r < payload_case) ? r : r + 1;
+  }
+
+  /// Writes the representation of case `c` to the instance at `base`.
+  ///
+  /// - Requires: if the case is stored in a niche and `c` is `payload_case`, the payload has been
+  ///   initialized already and doesn't take a spare value of the niche. In particular, none of
+  ///   its out-of-line fields is null. This requirement is checked in debug builds.
+  inline void set_case(void* base, std::size_t c) const {
+    if (width == 0) { return; }
+    auto p = static_cast<std::byte*>(base) + offset;
+    if (niche_count == 0) {
+      store(p, width, c);
+    } else if (c != payload_case) {
+      auto r = (c < payload_case) ? c : c - 1;
+      store(p, width, niche_start + r);
+    } else {
+      // Otherwise, the instance would be decoded as another case.
+      assert((load(p, width) - niche_start >= niche_count) && "payload takes a spare value");
+    }
+  }
+
+};
+
+}
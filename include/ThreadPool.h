@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xst {
+
+/// A fixed set of threads executing tasks that can spawn other tasks, balancing the load by work
+/// stealing.
+///
+/// Each worker has a queue of tasks. A worker runs the tasks that it spawned last first and steals
+/// the oldest tasks of other workers when its queue is empty, so that large pieces of work tend
+/// to be stolen rather than small ones. The thread calling `run` takes part in the execution.
+/// Idle workers sleep until a task is spawned, so a group whose root doesn't spawn anything runs
+/// on the calling thread alone.
+///
+/// An instance can only run one group of tasks at a time, but `run` can be called from multiple
+/// threads concurrently.
+struct ThreadPool {
+
+  /// A unit of work.
+  using Task = std::function<void()>;
+
+  /// Creates an instance with `thread_count` workers, including the thread calling `run`.
+  explicit ThreadPool(std::size_t thread_count = std::thread::hardware_concurrency());
+
+  ThreadPool(ThreadPool const&) = delete;
+
+  ThreadPool& operator=(ThreadPool const&) = delete;
+
+  /// Destroys `this`, joining its threads.
+  ///
+  /// - Requires: no call to `run` is in progress.
+  ~ThreadPool();
+
+  /// Returns the number of workers in `this`, including the thread calling `run`.
+  inline std::size_t size() const {
+    return queues.size();
+  }
+
+  /// Runs `root` and the tasks that it spawns, transitively, and returns once they are all done.
+  ///
+  /// If a task throws, the exception of one of the tasks that threw is rethrown once all tasks
+  /// are done.
+  ///
+  /// - Requires: this method is not called from a task of `this`.
+  void run(Task root);
+
+  /// Schedules `task` to be run by one of the workers of the call to `run` that is in progress.
+  ///
+  /// - Requires: this method is called from a task of `this`.
+  void spawn(Task task);
+
+private:
+
+  /// The tasks spawned by a worker that haven't been started yet.
+  struct Queue {
+
+    /// The lock protecting `tasks`.
+    std::mutex mutex;
+
+    /// The tasks, oldest first.
+    std::deque<Task> tasks;
+
+  };
+
+  /// The queues of the workers, the first of which belongs to the thread calling `run`.
+  std::vector<std::unique_ptr<Queue>> queues;
+
+  /// The threads of the workers, except the first one.
+  std::vector<std::thread> threads;
+
+  /// The lock serializing the calls to `run`.
+  std::mutex run_mutex;
+
+  /// The lock protecting `stopping` and `error`, and through which sleeping threads are woken
+  /// up.
+  std::mutex mutex;
+
+  /// The condition notified when a task is queued or when `this` is destroyed.
+  std::condition_variable wake;
+
+  /// The condition notified when a task is queued or when the last task of the call to `run` in
+  /// progress is done.
+  std::condition_variable done;
+
+  /// `true` iff `this` is being destroyed.
+  bool stopping = false;
+
+  /// The number of tasks of the call to `run` in progress that are not done.
+  std::atomic<std::size_t> pending{0};
+
+  /// The number of tasks in the queues.
+  std::atomic<std::size_t> queued{0};
+
+  /// The exception thrown by a task of the call to `run` in progress, if any.
+  std::exception_ptr error;
+
+  /// Runs the tasks given to the worker at position `i`, sleeping while there is none, until
+  /// `this` is destroyed.
+  void work(std::size_t i);
+
+  /// Runs a task from the queue of the worker at position `i`, or steals one from another
+  /// worker, and returns `true`, or returns `false` if no task is available.
+  bool run_one(std::size_t i);
+
+};
+
+}
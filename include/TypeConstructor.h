@@ -0,0 +1,35 @@
+#pragma once
+
+#include "TypeHeader.h"
+
+#include <cstddef>
+#include <span>
+
+namespace xst {
+
+struct TypeStore;
+
+/// A generic type, such as `List`, whose instances are the types obtained by applying it to
+/// type arguments.
+struct TypeConstructor {
+
+  /// A function that defines `type`, which is the instance of a constructor applied to
+  /// `arguments`, in `store`.
+  using Definition = void(*)(
+    TypeStore& store, TypeHeader const* type, std::span<TypeHeader const* const> arguments);
+
+  /// The kind of the instances of this constructor, which is either `product` or `sum`.
+  TypeHeader::Kind kind;
+
+  /// The name of the instances of this constructor.
+  const char* name;
+
+  /// The number of arguments of this constructor.
+  std::size_t arity;
+
+  /// The function defining the instances of this constructor.
+  Definition define;
+
+};
+
+}
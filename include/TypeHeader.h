@@ -1,9 +1,13 @@
 #pragma once
 
+#include "Arena.h"
 #include "Utilities.h"
 
+#include <algorithm>
+#include <span>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace xst {
@@ -21,14 +25,29 @@ using AnyFunction = void(*)();
 /// The information necessary to uniquely identify atype.
 struct TypeHeader {
 
+  /// The kind of a type header.
+  enum Kind : uint8_t {
+    builtin,
+    product,
+    sum,
+  };
+
+  /// The kind of `this`.
+  const Kind kind;
+
+  /// Creates an instance with the given kind and hash.
+  constexpr TypeHeader(Kind kind, std::size_t hash) : kind(kind), hash(hash) {}
+
   /// Destorys `this`.
   virtual ~TypeHeader() = default;
 
   /// Returns a hash of the salient part of `this`.
-  virtual std::size_t hash_value() const = 0;
+  constexpr std::size_t hash_value() const {
+    return hash;
+  }
 
   /// Returns `true` iff `this` is equal to the given identifier.
-  virtual bool equal_to(TypeHeader const&) const = 0;
+  constexpr bool equal_to(TypeHeader const&) const;
 
   /// Returns a textual description of the type.
   virtual std::string description() const = 0;
@@ -38,6 +57,11 @@ struct TypeHeader {
     return this->equal_to(other);
   }
 
+protected:
+
+  /// A hash of the salient part of `this`, computed once when `this` is created.
+  std::size_t hash;
+
 private:
 
   // Note: The following methods are notionally methods of the type store and are no meant to be
@@ -46,9 +70,18 @@ private:
 
   friend TypeStore;
 
+  /// The position of `this` in the store that interned it, or `-1` if `this` isn't interned.
+  ///
+  /// This value is assigned by `TypeStore::declare` and used to access a header's metatype without
+  /// hashing it.
+  std::size_t index = -1;
+
   /// Implements `TypeStore::copy_initialize` for the described type.
   virtual void copy_initialize(void*, void*, TypeStore const&) const = 0;
 
+  /// Implements `TypeStore::move_initialize` for the described type.
+  virtual void move_initialize(void*, void*, TypeStore const&) const = 0;
+
   /// Implements `TypeStore::deinitialize` for the described type.
   virtual void deinitialize(void*, TypeStore const&) const = 0;
 
@@ -73,7 +106,12 @@ struct BuiltinHeader final : public TypeHeader {
   Value raw_value;
 
   /// Creates an instance with the given raw value.
-  constexpr BuiltinHeader(Value raw_value) : raw_value(raw_value) {}
+  constexpr BuiltinHeader(
+    Value raw_value
+  ) : TypeHeader(builtin, hash_of(raw_value)), raw_value(raw_value) {}
+
+  /// Creates a copy of `other` whose storage is allocated in `arena`.
+  constexpr BuiltinHeader(BuiltinHeader const& other, Arena&) : BuiltinHeader(other) {}
 
   /// Returns the size of an instance of the type.
   constexpr std::size_t size() const {
@@ -97,17 +135,20 @@ struct BuiltinHeader final : public TypeHeader {
     }
   }
 
-  constexpr std::size_t hash_value() const override {
-    return static_cast<std::size_t>(raw_value);
+  /// Returns `true` iff `this` is equal to `other`.
+  constexpr bool equal_to(BuiltinHeader const& other) const {
+    return this->raw_value == other.raw_value;
   }
 
-  constexpr bool equal_to(TypeHeader const& other) const override {
-    auto const* that = dynamic_cast<BuiltinHeader const*>(&other);
-    if (that != nullptr) {
-      return this->raw_value == that->raw_value;
-    } else {
-      return false;
-    }
+  /// Returns the hash of the header of the built-in type identified by `raw_value`.
+  ///
+  /// The identifier is mixed like the properties of composite headers, so that the headers of
+  /// built-in types are spread across the shards and probe groups of a type store.
+  static constexpr std::size_t hash_of(Value raw_value) {
+    Hasher h;
+    h.combine_word(builtin);
+    h.combine_word(raw_value);
+    return h.finalize();
   }
 
   constexpr std::string description() const override {
@@ -124,6 +165,8 @@ private:
 
   void copy_initialize(void*, void*, TypeStore const&) const override;
 
+  void move_initialize(void*, void*, TypeStore const&) const override;
+
   void deinitialize(void*, TypeStore const&) const override;
 
   void dump_instance(std::ostream&, void*, TypeStore const&) const override;
@@ -137,23 +180,69 @@ struct CompositeHeader : public TypeHeader {
   const char* name;
 
   /// The type arguments of the type.
-  const std::vector<TypeHeader const*> arguments;
+  std::span<TypeHeader const* const> arguments;
 
   /// Creates an instance with the given properties.
-  constexpr CompositeHeader(
-    const char* name, std::initializer_list<TypeHeader const*> arguments
-  ) : name(name), arguments(arguments) {}
+  CompositeHeader(
+    Kind kind, const char* name, std::initializer_list<TypeHeader const*> arguments
+  ) : TypeHeader(kind, 0), name(name), storage(arguments) {
+    this->arguments = storage;
+    hash = hash_of(kind, name, this->arguments);
+  }
 
   /// Creates an instance with the given properties.
   template<typename Iterator>
-  constexpr CompositeHeader(
-    const char* name, Iterator first, Iterator last
-  ) : name(name), arguments(first, last) {}
+  CompositeHeader(
+    Kind kind, const char* name, Iterator first, Iterator last
+  ) : TypeHeader(kind, 0), name(name), storage(first, last) {
+    this->arguments = storage;
+    hash = hash_of(kind, name, this->arguments);
+  }
+
+  /// Creates an instance with the given properties, whose hash is `hash`.
+  ///
+  /// - Requires: `hash` is the hash of a header with the given properties and `arguments` outlive
+  ///   `this`.
+  CompositeHeader(
+    Kind kind, const char* name, std::span<TypeHeader const* const> arguments, std::size_t hash
+  ) : TypeHeader(kind, hash), name(name), arguments(arguments) {}
+
+  /// Creates a copy of `other`.
+  CompositeHeader(
+    CompositeHeader const& other
+  ) : TypeHeader(other), name(other.name), storage(other.arguments.begin(), other.arguments.end()) {
+    this->arguments = storage;
+  }
+
+  /// Creates a copy of `other` whose arguments are allocated in `arena`.
+  CompositeHeader(
+    CompositeHeader const& other, Arena& arena
+  ) : TypeHeader(other), name(other.name), arguments(arena.copy(other.arguments)) {}
+
+  /// Returns `true` iff `this` is equal to `other`.
+  ///
+  /// Names are compared by contents, so that headers created from different copies of the same
+  /// name are equal.
+  ///
+  /// - Requires: `this` and `other` have the same kind.
+  constexpr bool equal_to(CompositeHeader const& other) const {
+    auto same_name = (this->name == other.name) || (std::string_view{name} == other.name);
+    return same_name && std::equal(
+      arguments.begin(), arguments.end(), other.arguments.begin(), other.arguments.end());
+  }
 
-  constexpr std::size_t hash_value() const override {
+  /// Returns the hash of a header with the given kind and name, whose arguments have the hashes
+  /// `argument_hashes`.
+  ///
+  /// - Note: The result is the hash of any header created with these properties, so that it can
+  ///   be checked before the headers of the arguments exist.
+  static std::size_t hash_of(
+    Kind kind, std::string_view name, std::span<std::size_t const> argument_hashes
+  ) {
     Hasher h;
-    h.combine(name);
-    h.combine(arguments.begin(), arguments.end());
+    h.combine_word(kind);
+    h.combine_bytes(name);
+    h.combine_hashes(argument_hashes);
     return h.finalize();
   }
 
@@ -172,35 +261,58 @@ struct CompositeHeader : public TypeHeader {
     return o.str();
   }
 
+private:
+
+  /// The storage of `arguments`, unless `this` has been allocated in an arena.
+  std::vector<TypeHeader const*> storage;
+
+  /// Returns a hash of a composite header with the given properties.
+  ///
+  /// The hash only depends on the contents of the name and on the hashes of the arguments, so
+  /// that it is the same in every process.
+  static std::size_t hash_of(
+    Kind kind, const char* name, std::span<TypeHeader const* const> arguments
+  ) {
+    Hasher h;
+    h.combine_word(kind);
+    h.combine_bytes(name);
+    h.combine_hashes(arguments);
+    return h.finalize();
+  }
+
 };
 
 /// The header of a product type.
 struct StructHeader final : public CompositeHeader {
 
   /// Creates an instance with the given properties.
-  constexpr StructHeader(
+  StructHeader(
     const char* name, std::initializer_list<TypeHeader const*> arguments
-  ) : CompositeHeader(name, arguments) {}
+  ) : CompositeHeader(product, name, arguments) {}
 
   /// Creates an instance with the given properties.
   template<typename Iterator>
-  constexpr StructHeader(
+  StructHeader(
     const char* name, Iterator first, Iterator last
-  ) : CompositeHeader(name, first, last) {}
-
-  constexpr bool equal_to(TypeHeader const& other) const override {
-    auto const* that = dynamic_cast<StructHeader const*>(&other);
-    if (that != nullptr) {
-      return (this->name == that->name) && (this->arguments == that->arguments);
-    } else {
-      return false;
-    }
-  }
+  ) : CompositeHeader(product, name, first, last) {}
+
+  /// Creates an instance with the given properties, whose hash is `hash`.
+  ///
+  /// - Requires: `hash` is the hash of a header with the given properties and `arguments` outlive
+  ///   `this`.
+  StructHeader(
+    const char* name, std::span<TypeHeader const* const> arguments, std::size_t hash
+  ) : CompositeHeader(product, name, arguments, hash) {}
+
+  /// Creates a copy of `other` whose storage is allocated in `arena`.
+  StructHeader(StructHeader const& other, Arena& arena) : CompositeHeader(other, arena) {}
 
 private:
 
   void copy_initialize(void*, void*, TypeStore const&) const override;
 
+  void move_initialize(void*, void*, TypeStore const&) const override;
+
   void deinitialize(void*, TypeStore const&) const override;
 
   void dump_instance(std::ostream&, void*, TypeStore const&) const override;
@@ -211,29 +323,53 @@ private:
 struct EnumHeader final : public CompositeHeader {
 
   /// Creates an instance with the given properties.
-  constexpr EnumHeader(
+  EnumHeader(
      const char* name, std::initializer_list<TypeHeader const*> arguments
-   ) : CompositeHeader(name, arguments) {}
-
-  constexpr bool equal_to(TypeHeader const& other) const override {
-    auto const* that = dynamic_cast<EnumHeader const*>(&other);
-    if (that != nullptr) {
-      return (this->name == that->name) && (this->arguments == that->arguments);
-    } else {
-      return false;
-    }
-  }
+   ) : CompositeHeader(sum, name, arguments) {}
+
+  /// Creates an instance with the given properties.
+  template<typename Iterator>
+  EnumHeader(
+    const char* name, Iterator first, Iterator last
+  ) : CompositeHeader(sum, name, first, last) {}
+
+  /// Creates an instance with the given properties, whose hash is `hash`.
+  ///
+  /// - Requires: `hash` is the hash of a header with the given properties and `arguments` outlive
+  ///   `this`.
+  EnumHeader(
+    const char* name, std::span<TypeHeader const* const> arguments, std::size_t hash
+  ) : CompositeHeader(sum, name, arguments, hash) {}
+
+  /// Creates a copy of `other` whose storage is allocated in `arena`.
+  EnumHeader(EnumHeader const& other, Arena& arena) : CompositeHeader(other, arena) {}
 
 private:
 
   void copy_initialize(void*, void*, TypeStore const&) const override;
 
+  void move_initialize(void*, void*, TypeStore const&) const override;
+
   void deinitialize(void*, TypeStore const&) const override;
 
   void dump_instance(std::ostream&, void*, TypeStore const&) const override;
 
 };
 
+constexpr bool TypeHeader::equal_to(TypeHeader const& other) const {
+  if (this == &other) {
+    return true;
+  } else if ((this->kind != other.kind) || (this->hash != other.hash)) {
+    return false;
+  } else if (kind == builtin) {
+    return static_cast<BuiltinHeader const&>(*this).equal_to(
+      static_cast<BuiltinHeader const&>(other));
+  } else {
+    return static_cast<CompositeHeader const&>(*this).equal_to(
+      static_cast<CompositeHeader const&>(other));
+  }
+}
+
 }
 
 template<>
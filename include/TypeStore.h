@@ -1,10 +1,27 @@
 #pragma once
 
+#include "Allocator.h"
+#include "Arena.h"
+#include "InterningTable.h"
 #include "Metatype.h"
+#include "OutputBuffer.h"
+#include "ScratchArena.h"
+#include "Statistics.h"
+#include "TypeConstructor.h"
 #include "TypeHeader.h"
 #include "Utilities.h"
+#include "WitnessTable.h"
 
-#include <unordered_map>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
 
 namespace xst {
 
@@ -19,51 +36,472 @@ struct MetatypeConstructor {
   /// (i.e., undefined) instance to be defined later by `TypeStore::define`. Specialization of this
   /// method can return a defined metatype so that the instance associated with a header is defined
   /// automatically in `TypeStore::declare`.
+  ///
+  /// - Note: The header passed to this method is equal to the one about to be inserted but it is
+  ///   not interned in the store yet. It should not be used to access the store.
   Metatype operator()(Header const*, TypeStore&) {
     return Metatype{};
   }
 
 };
 
+/// A collection of type headers and their metatypes.
+///
+/// A type store can be used from multiple threads concurrently. Accessing the metatype of a type
+/// that has been declared and defined, using the pointer returned by `declare`, doesn't involve any
+/// lock. Declaring and defining types synchronize through a lock on one of the shards of the
+/// interning table, chosen by the hash of the header that is being declared or defined.
 struct TypeStore {
 private:
 
-  /// An array containing the type headers allocated in this store.
-  std::vector<std::unique_ptr<TypeHeader>> headers;
+  /// The number of shards in the interning table of a store.
+  static constexpr std::size_t shard_count = 16;
+
+  /// The number of entries in the first segment of the entry table of a store.
+  static constexpr std::size_t first_segment_size = 64;
+
+  /// The maximum number of segments in the entry table of a store.
+  static constexpr std::size_t segment_count = 32;
+
+  /// The application of a type constructor to arguments, used to memoize instantiations.
+  struct Instantiation {
+
+    /// A function hashing instances by returning their `hash`.
+    struct Hash {
+
+      inline std::size_t operator()(Instantiation const& i) const {
+        return i.hash;
+      }
+
+    };
+
+    /// The constructor applied.
+    TypeConstructor const* constructor;
+
+    /// The arguments of the application.
+    std::span<TypeHeader const* const> arguments;
+
+    /// A hash of `constructor` and of the addresses of `arguments`.
+    std::size_t hash;
+
+    /// The instance of `constructor` applied to `arguments`, or `nullptr` if `this` is a key.
+    TypeHeader const* type = nullptr;
+
+    /// Returns `true` iff `this` and `other` apply the same constructor to the same arguments.
+    inline bool operator==(Instantiation const& other) const {
+      return (constructor == other.constructor) && std::ranges::equal(arguments, other.arguments);
+    }
+
+  };
+
+  /// A part of the interning table of a store.
+  struct Shard {
+
+    /// The lock protecting this shard and the definition of the types that it contains.
+    std::mutex mutex;
+
+    /// The storage of the headers in this shard, their arguments, and their metatypes.
+    Arena arena;
+
+    /// The set of type headers allocated in this shard, used for interning.
+    InterningTable<TypeHeader> interned;
+
+    /// The instantiations of type constructors allocated in this shard, used for memoization.
+    ///
+    /// Instantiations are inserted while holding `mutex` but looked up without locking.
+    ConcurrentInterningTable<Instantiation, Instantiation::Hash> instantiations;
+
+  };
+
+  /// The information associated with a type header in a store.
+  struct Entry {
+
+    /// The header of this entry, or `nullptr` if it hasn't been published yet.
+    std::atomic<TypeHeader const*> header{nullptr};
+
+    /// `true` iff `metatype` has been published.
+    std::atomic<bool> is_defined{false};
+
+    /// The metatype of `header`, which is immutable once published.
+    Metatype metatype;
+
+    /// The witness table of `header`, which is immutable once `metatype` is published.
+    WitnessTable witnesses;
+
+    /// The description of `header`, allocated in the arena of its shard.
+    std::string_view description;
+
+    /// The instantiation defining `header` on demand, if it's the instance of a type constructor.
+    std::atomic<Instantiation const*> instantiation{nullptr};
+
+  };
+
+  /// The operations of a witness table, before they are allocated in the arena of a shard.
+  struct WitnessOperations {
+
+    /// The operations of the table, unless it describes a sum type.
+    std::vector<WitnessTable::Operation> operations;
+
+    /// The operations on the payload of each case, if the table describes a sum type.
+    std::vector<std::vector<WitnessTable::Operation>> cases;
+
+    /// `true` iff the table describes a type whose instances can be compared bitwise.
+    bool bitwise_equatable = false;
+
+  };
+
+  /// The shards of the interning table.
+  mutable std::array<Shard, shard_count> shards;
+
+  /// The entries of the types declared in this store, indexed by the position of their header.
+  ///
+  /// Entries are allocated in segments, the `k`-th segment containing `first_segment_size << k`
+  /// entries, so that they never move once allocated.
+  std::array<std::atomic<Entry*>, segment_count> segments{};
+
+  /// The number of positions that have been assigned to type headers in this store.
+  std::atomic<std::size_t> entry_count{0};
+
+  /// The allocator of the out-of-line storage of the values whose types are in this store.
+  Allocator* allocator = &Allocator::heap();
+
+#if defined(XST_STATISTICS)
+  /// The counts of the events that occurred in this store.
+  mutable Statistics counters;
+#endif
+
+  /// Records `n` occurrences of `e` on the type whose ID is `type`.
+  ///
+  /// This method is a no-op unless `XST_STATISTICS` is defined.
+  inline void record(
+    [[maybe_unused]] Statistics::Event e, [[maybe_unused]] std::size_t type,
+    [[maybe_unused]] uint64_t n = 1
+  ) const {
+#if defined(XST_STATISTICS)
+    counters.record(e, type, n);
+#endif
+  }
+
+  /// Configures the witness table of `e`, whose ID is `type`, to record events in this store.
+  ///
+  /// This method is a no-op unless `XST_STATISTICS` is defined.
+  inline void instrument([[maybe_unused]] Entry& e, [[maybe_unused]] std::size_t type) const {
+#if defined(XST_STATISTICS)
+    e.witnesses.statistics = &counters;
+    e.witnesses.type = type;
+#endif
+  }
+
+  /// Returns the shard containing headers with the given hash.
+  inline Shard& shard(std::size_t hash) const {
+    // The low bits of the hash are used to probe the interning table.
+    return shards[(hash >> 57) % shard_count];
+  }
+
+  /// Returns the entry at position `i`, or `nullptr` if that position is not allocated.
+  inline Entry* entry(std::size_t i) const {
+    auto j = i + first_segment_size;
+    if (j < i) { return nullptr; }
+    auto k = std::bit_width(j) - std::bit_width(first_segment_size);
+    if (k >= segment_count) { return nullptr; }
+    auto s = segments[k].load(std::memory_order_acquire);
+    return (s != nullptr) ? s + (j - (first_segment_size << k)) : nullptr;
+  }
+
+  /// Returns the entry of `t` iff `t` is the unique instance interned in `this`. Otherwise,
+  /// returns `nullptr`.
+  inline Entry* interned_entry(TypeHeader const* t) const {
+    auto e = entry(t->index);
+    return ((e != nullptr) && (e->header.load(std::memory_order_acquire) == t)) ? e : nullptr;
+  }
+
+  /// Returns the entry of the unique instance equal to `t` in this store, or `nullptr` if there is
+  /// no such instance.
+  Entry* entry_of(TypeHeader const* t) const;
+
+  /// Returns `t`'s entry, or throws an exception if `t` isn't declared in `this`.
+  Entry& get_declared_entry(TypeHeader const* t) const;
+
+  /// Returns `t`'s entry, or throws an exception if `t` isn't declared or defined in `this`.
+  ///
+  /// If `t` is an instance of a type constructor that hasn't been defined yet, it is defined
+  /// first.
+  Entry const& get_defined_entry(TypeHeader const* t) const;
+
+  /// Defines the type of `e` with the definition of its type constructor, if any.
+  void define_on_demand(Entry const& e) const;
+
+  /// Returns the operations of the witness table of a type of kind `k` whose metatype is `m`.
+  ///
+  /// - Requires: `m` is defined and the types of its fields have been declared in `this`.
+  WitnessOperations compile(TypeHeader::Kind k, Metatype const& m) const;
+
+  /// Appends to `operations` the witness operations of the field `f` stored at `offset`.
+  void compile(
+    Field const& f, std::size_t offset, std::vector<WitnessTable::Operation>& operations
+  ) const;
+
+  /// Returns `true` iff instances of a type of kind `k` described by `m` can be compared bitwise.
+  ///
+  /// - Requires: `m` is defined and the types of its inline fields are defined in `this`.
+  bool bitwise_equatable(TypeHeader::Kind k, Metatype const& m) const;
+
+  /// Returns the encoding of the case of an instance of a sum type with the given `cases` in a
+  /// niche of its payload, or a dedicated tag encoding if no niche can be used.
+  ///
+  /// A niche can be used if all cases but one have no payload, and that payload has enough spare
+  /// values to represent the other cases. Spare values are the null address of an out-of-line
+  /// field, along with the addresses below the alignment of its type if that type is built-in,
+  /// the values of a `boolean` other than 0 and 1, and the values of the dedicated tag of an
+  /// inline sum past its last case.
+  ///
+  /// - Requires: the types of `cases` have been declared and defined in `this`.
+  TagEncoding niche_encoding(std::span<Field const> cases) const;
 
-  /// A table from a type identifier to its corresponding metatype.
-  std::unordered_map<DereferencingKey<TypeHeader>, Metatype> metatype;
+  /// Returns the encoding of `count` cases in spare values of an instance of `f` stored at
+  /// `offset`, or a dedicated tag encoding if `f` doesn't have enough spare values.
+  ///
+  /// - Requires: the type of `f` has been declared and defined in `this`.
+  TagEncoding niche(Field const& f, std::size_t offset, std::size_t count) const;
+
+  /// Assigns the witness table of `e`, whose header has kind `k`, allocating the operations `w`
+  /// in `arena`.
+  ///
+  /// - Requires: the metatype of `e` is defined.
+  void install(Entry& e, TypeHeader::Kind k, WitnessOperations const& w, Arena& arena) const;
 
-  /// Returns `t`'s metatype.
+  /// Interns `h`, whose hash is `hash`, with metatype `m` and witness operations `w` in `s`.
+  ///
+  /// If `instantiation` isn't `nullptr`, it is assigned to the entry of `h` before `h` is
+  /// published, so that `h` can be defined on demand as soon as it can be found.
   ///
-  /// - Requires: `t` has been declared and never explicitly defined in `this`.
-  Metatype& get_undefined_metatype(TypeHeader const* t);
+  /// - Requires: `s` is locked, is the shard of `h`, doesn't contain a header equal to `h`, and
+  ///   `h` is allocated in the arena of `s`.
+  void intern(
+    Shard& s, TypeHeader* h, std::size_t hash, Metatype&& m, WitnessOperations const& w,
+    std::string_view description, Instantiation* instantiation = nullptr);
+
+  /// Assigns `instantiation`, if any, to the entry `e` of `h` unless it has one already.
+  inline void attach(Entry& e, TypeHeader const* h, Instantiation* instantiation) const {
+    if (instantiation == nullptr) { return; }
+    instantiation->type = h;
+    Instantiation const* expected = nullptr;
+    e.instantiation.compare_exchange_strong(expected, instantiation, std::memory_order_acq_rel);
+  }
+
+  /// Implements `declare(identifier)`, assigning `instantiation`, if any, to the entry of the
+  /// result as `intern` does, unless that entry has one already.
+  template<typename T, typename M = MetatypeConstructor<T>>
+  T const* declare(T&& identifier, Instantiation* instantiation) {
+    auto hash = identifier.hash_value();
+    auto& s = shard(hash);
+
+    // The identifier is already known.
+    {
+      std::lock_guard<std::mutex> l{s.mutex};
+      auto p = s.interned.find(identifier, hash);
+      if (p != nullptr) {
+        record(Statistics::declare_hit, p->index);
+        attach(*entry(p->index), p, instantiation);
+        return static_cast<T const*>(p);
+      }
+    }
+
+    // The identifier is unknown; compute its metatype without holding any lock, as `M` may declare
+    // other types, and intern it unless another thread did so concurrently.
+    auto m = M{}(&identifier, *this);
+    auto w = m.defined() ? compile(identifier.kind, m) : WitnessOperations{};
+    auto d = identifier.description();
+    std::lock_guard<std::mutex> l{s.mutex};
+    auto p = s.interned.find(identifier, hash);
+    if (p != nullptr) {
+      record(Statistics::declare_hit, p->index);
+      attach(*entry(p->index), p, instantiation);
+      return static_cast<T const*>(p);
+    }
+
+    auto h = s.arena.template create<T>(identifier, s.arena);
+    intern(s, h, hash, std::move(m), w, d, instantiation);
+    record(Statistics::declare_miss, h->index);
+    return h;
+  }
+
+  /// Publishes `m` and the witness operations `w` as the definition of `t`, whose entry is `e`,
+  /// and returns the metatype of `t`.
+  ///
+  /// The payload of `m` is copied into the arena of the shard of `t`. If `t` has been defined
+  /// concurrently, the existing definition is returned if it has the same fields. Otherwise, an
+  /// exception is thrown.
+  Metatype const& publish(
+    Entry& e, TypeHeader const* t, Metatype&& m, WitnessOperations const& w);
+
+  /// Returns the address of zero-initialized storage for an instance of `t`, allocated with
+  /// `allocator`, or `empty_box()` if instances of `t` have no size.
+  ///
+  /// - Requires: `t` has been declared and defined in `this`.
+  inline void* allocate_box(TypeHeader const* t) const {
+    return allocate_box(t, *allocator);
+  }
+
+  /// Returns the address of zero-initialized storage for an instance of `t`, allocated with `a`,
+  /// or `empty_box()` if instances of `t` have no size.
+  ///
+  /// - Requires: `t` has been declared and defined in `this`.
+  void* allocate_box(TypeHeader const* t, Allocator& a) const;
+
+  /// Implements `address_of(m, i, base)`, allocating new out-of-line storage with `a`.
+  void* address_of(Metatype const& m, std::size_t i, void* base, Allocator& a) const;
+
+  /// Implements `copy_initialize_enum(type, tag, target, source)`, allocating new out-of-line
+  /// storage with `a`.
+  void copy_initialize_enum(
+    EnumHeader const* type, std::size_t tag, void* target, void* source, Allocator& a) const;
+
+  /// Implements `move_initialize_enum(type, tag, target, source)`, allocating new out-of-line
+  /// storage with `a`.
+  void move_initialize_enum(
+    EnumHeader const* type, std::size_t tag, void* target, void* source, Allocator& a) const;
+
+  /// Deallocates `p`, which has been returned by `allocate_box(t)`.
+  ///
+  /// This method is a no-op if `p` is `nullptr` or if instances of `t` have no size.
+  void deallocate_box(TypeHeader const* t, void* p) const;
 
 public:
 
-  /// Creates an empty instance.
+  /// The way the fields of a product type are laid out in memory.
+  enum LayoutPolicy : uint8_t {
+
+    /// Fields are stored in declaration order.
+    declaration_order,
+
+    /// Fields are stored by decreasing alignment, which minimizes the padding between them.
+    minimize_padding,
+
+  };
+
+  /// Creates an empty instance allocating out-of-line storage on the global heap.
   TypeStore() = default;
 
+  /// Creates an empty instance allocating out-of-line storage with `allocator`.
+  ///
+  /// - Requires: `allocator` outlives `this` and the values whose types are in `this`.
+  explicit TypeStore(Allocator& allocator) : allocator(&allocator) {}
+
+  TypeStore(TypeStore const&) = delete;
+
+  TypeStore& operator=(TypeStore const&) = delete;
+
+  /// Destroys `this` and the types that it contains.
+  ~TypeStore();
+
   /// Returns a pointer to the unique instance equal to `identifier` in this store.
+  ///
+  /// If `identifier` is unknown, `M` is called with `identifier` before a copy of it is interned.
   template<typename T, typename M = MetatypeConstructor<T>>
   T const* declare(T&& identifier) {
-    auto entry = metatype.find(DereferencingKey<TypeHeader>{&identifier});
+    return declare<T, M>(std::forward<T>(identifier), nullptr);
+  }
 
-    // The identifier is already known.
-    if (entry != metatype.end()) {
-      return static_cast<T const*>(entry->first.value);
-    }
+  /// Returns the allocator of the out-of-line storage of the values whose types are in `this`.
+  inline Allocator& value_allocator() const {
+    return *allocator;
+  }
 
-    // The identifier is unknown; intern it.
-    else {
-      headers.emplace_back(std::make_unique<T>(std::move(identifier)));
-      auto const* p = headers.back().get();
-      auto const* q = static_cast<T const*>(p);
-      metatype.emplace(std::make_pair(DereferencingKey{p}, M{}(q, *this)));
-      return q;
-    }
+  /// Sets the allocator of the out-of-line storage of the values whose types are in `this`.
+  ///
+  /// - Requires: `allocator` outlives `this` and the values whose types are in `this`, and no
+  ///   out-of-line storage allocated by the current allocator is alive.
+  inline void set_value_allocator(Allocator& allocator) {
+    this->allocator = &allocator;
+  }
+
+  /// Ensures that `n` types can be declared in this store without allocating new storage for its
+  /// interning table and metatypes.
+  void reserve(std::size_t n);
+
+  /// Returns the ID of `type`, which is the position at which it has been declared in `this`.
+  ///
+  /// - Requires: `type` has been declared in `this`.
+  inline std::size_t id(TypeHeader const* type) const {
+    auto e = interned_entry(type);
+    return (e != nullptr) ? type->index : get_declared_entry(type).header.load()->index;
+  }
+
+  /// Returns the header whose ID is `id`, or `nullptr` if there is no such header in `this`.
+  inline TypeHeader const* header(std::size_t id) const {
+    auto e = entry(id);
+    return (e != nullptr) ? e->header.load(std::memory_order_acquire) : nullptr;
+  }
+
+  /// Returns a position-independent snapshot of the types declared in `this`.
+  ///
+  /// A snapshot records the header, description, and hash of each type, as well as its metatype
+  /// and witness operations if it is defined. Types refer to each other by ID, so that a snapshot
+  /// can be written to a file and restored by another process with `restore`. Types declared or
+  /// defined concurrently may be missing or undefined in the result.
+  ///
+  /// - Requires: the arguments of a type have been declared in `this` before that type.
+  std::vector<std::byte> snapshot() const;
+
+  /// Declares and defines the types recorded in `snapshot`, which has been returned by `snapshot`.
+  ///
+  /// Headers are interned with their recorded hash, and metatypes and witness tables are rebuilt
+  /// from their recorded layout, so that neither hashes nor layouts are computed again. The ID of
+  /// each type in `this` is its position in the snapshot. Headers are then obtained with `header`,
+  /// or by declaring them again. An exception is thrown if `snapshot` is malformed, in which case
+  /// `this` is left unchanged.
+  ///
+  /// Layouts are checked for consistency, but recorded hashes are only checked in debug builds,
+  /// where they are computed again.
+  ///
+  /// - Requires: `this` is empty and isn't used concurrently, and `snapshot` has been created by a
+  ///   program with the same data layout.
+  void restore(std::span<std::byte const> snapshot);
+
+  /// Returns a new type constructor whose instances are types of the given `kind` and `name`,
+  /// applied to `arity` arguments, and defined by `define`.
+  ///
+  /// - Requires: `kind` is either `product` or `sum`, and `name` outlives `this`.
+  TypeConstructor const* register_constructor(
+    TypeHeader::Kind kind, const char* name, std::size_t arity,
+    TypeConstructor::Definition define);
+
+  /// Returns the instance of `constructor` applied to `arguments`, declaring it if necessary.
+  ///
+  /// Instantiations are memoized on the addresses of `constructor` and `arguments`, so that the
+  /// instance is found without allocating or locking once it has been declared. The instance is
+  /// defined on demand, by calling the definition of `constructor` the first time its metatype is
+  /// needed.
+  /// Until then, `defined` returns `false` for that instance.
+  ///
+  /// - Requires: `constructor` has been returned by `register_constructor` on `this` and the
+  ///   number of `arguments` is its arity.
+  TypeHeader const* instantiate(
+    TypeConstructor const* constructor, std::span<TypeHeader const* const> arguments);
+
+  /// Returns the instance of `constructor` applied to `arguments`, declaring it if necessary.
+  ///
+  /// - Requires: `constructor` has been returned by `register_constructor` on `this` and the
+  ///   number of `arguments` is its arity.
+  inline TypeHeader const* instantiate(
+    TypeConstructor const* constructor, std::initializer_list<TypeHeader const*> arguments
+  ) {
+    return instantiate(constructor, std::span{arguments.begin(), arguments.end()});
   }
 
+#if defined(XST_STATISTICS)
+  /// Returns the number of occurrences of each event on each type in `this`, indexed by ID and
+  /// aggregated over all threads.
+  inline std::vector<Statistics::Counts> statistics() const {
+    return counters.snapshot();
+  }
+
+  /// Appends to `output` a table of the events on each type in `this`, with the types on which
+  /// the most bytes were allocated first, followed by the most copied ones.
+  void dump_statistics(OutputBuffer& output) const;
+#endif
+
   /// Returns a pointer to the unique instance identifying `tag` in this store.
   inline BuiltinHeader const* declare(BuiltinHeader::Value tag) {
     return declare(BuiltinHeader{tag});
@@ -75,25 +513,66 @@ public:
   /// the second denotes the return type, and the remainder denotes the types of the parameters.
   StructHeader const* declare_lambda(std::vector<TypeHeader const*>&& api);
 
-  /// Assigns a metatype definition to `type`.
+  /// Assigns a metatype definition to `type`, laying out its fields with `policy`.
   ///
-  /// - Requires: `type` has been declared and never explicitly defined in `this`.
-  Metatype const& define(StructHeader const* type, std::vector<Field>&&);
+  /// Fields are identified by their index in declaration order regardless of `policy`, which only
+  /// determines their offsets. If `type` has been defined concurrently by another thread with the
+  /// same fields and layout, the existing definition is returned. This situation occurs when
+  /// several threads run the declare-then-define pattern on the same type.
+  ///
+  /// - Requires: `type` has been declared and never defined in `this` with different fields or
+  ///   a different layout.
+  Metatype const& define(
+    StructHeader const* type, std::vector<Field>&&, LayoutPolicy policy = declaration_order);
 
   /// Assigns a metatype definition to `type`.
   ///
-  /// - Requires: `type` has been declared and never explicitly defined in `this`.
+  /// If `type` has been defined concurrently by another thread with the same fields, the existing
+  /// definition is returned. This situation occurs when several threads run the declare-then-define
+  /// pattern on the same type.
+  ///
+  /// - Requires: `type` has been declared and never defined in `this` with different fields.
   Metatype const& define(EnumHeader const* type, std::vector<Field>&&);
 
   /// Accesses the metatype associated to `type`.
   ///
   /// - Requires: `type` has been declared and defined in `this`.
-  Metatype const& operator[](TypeHeader const* type) const;
+  inline Metatype const& operator[](TypeHeader const* type) const {
+    auto e = interned_entry(type);
+    if ((e != nullptr) && e->is_defined.load(std::memory_order_acquire)) {
+      record(Statistics::metatype_lookup, type->index);
+      return e->metatype;
+    } else {
+      auto const& d = get_defined_entry(type);
+      record(Statistics::metatype_lookup, d.header.load(std::memory_order_relaxed)->index);
+      return d.metatype;
+    }
+  }
+
+  /// Returns the description of `type`, which is computed once when `type` is interned.
+  ///
+  /// - Requires: `type` has been declared in `this`.
+  inline std::string_view description(TypeHeader const* type) const {
+    auto e = interned_entry(type);
+    return (e != nullptr) ? e->description : get_declared_entry(type).description;
+  }
+
+  /// Returns the witness table of `type`.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`.
+  inline WitnessTable const& witnesses(TypeHeader const* type) const {
+    auto e = interned_entry(type);
+    if ((e != nullptr) && e->is_defined.load(std::memory_order_acquire)) {
+      return e->witnesses;
+    } else {
+      return get_defined_entry(type).witnesses;
+    }
+  }
 
   /// Returns `true` iff `h` has been declared and defined in `this`.
   inline bool defined(TypeHeader const* h) const {
-    auto entry = metatype.find(DereferencingKey<TypeHeader>{h});
-    return (entry != metatype.end()) && entry->second.defined();
+    auto e = entry_of(h);
+    return (e != nullptr) && e->is_defined.load(std::memory_order_acquire);
   }
 
   /// Returns `true` iff instances of `type` do not involve out-of-line storage.
@@ -148,15 +627,13 @@ public:
   ///
   /// - Requires: `type` has been declared and defined in `this`.
   inline std::size_t stride(TypeHeader const* type) const {
-    auto x = round_up_to_nearest_multiple(size(type), alignment(type));
-    return x < 1 ? 1 : x;
+    return (*this)[type].stride();
   }
 
   /// Returns the offset of the `i`-th field of `m`.
   ///
-  /// - Note: An instance of a sum type with more than two cases has only one field, representing
-  ///   its tag. The payload is stored at the base address and is not counted as a field. Sum types
-  ///   with less than two cases have no tag and thus no field.
+  /// - Note: The fields of a sum type are the payloads of its cases, which are all stored at the
+  ///   base address. The case of an instance is represented as described by `m.tag_encoding()`.
   ///
   /// - Requires: `m` is the metatype of a product or sum type that has been declared and defined
   ///   in `this`, and `i` is less the number of fields in `m`.
@@ -168,17 +645,39 @@ public:
   ///
   /// New storage is allocated iff the field whose address is computed is stored out-of-line and
   /// not already allocated. The returned address points at memory capable of storing an instance
-  /// of the field's type.
+  /// of the field's type. If the field is stored in a shared box that has other references, the
+  /// box is copied first so that writing through the returned address doesn't affect other values.
   ///
   /// - Requires: `m` is the metatype of a product or sum type that has been declared and defined
   ///   in `this`, and `i` is less the number of fields in `m`.
-  void* address_of(Metatype const& m, std::size_t i, void* base) const;
+  inline void* address_of(Metatype const& m, std::size_t i, void* base) const {
+    return address_of(m, i, base, *allocator);
+  }
+
+  /// Returns `base` advanced by the offset of the `i`-th field of `m`, allocating new out-of-line
+  /// storage in `region`.
+  ///
+  /// - Requires: `m` is the metatype of a product or sum type that has been declared and defined
+  ///   in `this`, `i` is less the number of fields in `m`, and the out-of-line storage of the
+  ///   instance at `base` is allocated in `region`.
+  inline void* address_of(Metatype const& m, std::size_t i, void* base, Region& region) const {
+    return address_of(m, i, base, static_cast<Allocator&>(region));
+  }
+
+  /// Returns the address of the `i`-th field of the instance at `base`, for reading only.
+  ///
+  /// Unlike `address_of`, this method never allocates or copies storage. The result is `nullptr`
+  /// if the field is stored out-of-line and has not been allocated.
+  ///
+  /// - Requires: `m` is the metatype of a product or sum type that has been declared and defined
+  ///   in `this`, `i` is less the number of fields in `m`, and `base` is initialized.
+  void* read_address_of(Metatype const& m, std::size_t i, void* base) const;
 
   /// Returns `base` advanced by the offset of the `i`-th field of `type`.
   ///
   /// New storage is allocated iff the field whose address is computed is stored out-of-line and
   /// not already allocated. The returned address points at memory capable of storing an instance
-  /// of the field's type.
+  /// of the field's type. Shared boxes are copied on write, as with `address_of(m, i, base)`.
   ///
   /// - Requires: `type` has been declared and defined in `this` and `i` is less the number of
   ///   fields in an instance of `type`.
@@ -186,30 +685,42 @@ public:
     return address_of((*this)[type], i, base);
   }
 
+  /// Returns `base` advanced by the offset of the `i`-th field of `type`, allocating new
+  /// out-of-line storage in `region`.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`, `i` is less the number of fields
+  ///   in an instance of `type`, and the out-of-line storage of the instance at `base` is
+  ///   allocated in `region`.
+  inline void* address_of(
+    TypeHeader const* type, std::size_t i, void* base, Region& region
+  ) const {
+    return address_of((*this)[type], i, base, region);
+  }
+
   /// Calls `action` with the base address of a buffer with enough capacity to store `count`
   /// instances of `type`.
   ///
-  /// `action` is called with a pointer to a zero-initialized buffer properly aligned and large
-  /// enough to hold `count` instances of `type` contiguously (use `stride` to compute the offset
-  /// of each position). The buffer is automatically deallocated after `action` returns, at which
-  /// point the pointer passed to the lambda is invalid. Any instance stored in the temporary
-  /// buffer must be be deinitialized before `action` returns.
+  /// `action` is called with a pointer to a buffer properly aligned and large enough to hold
+  /// `count` instances of `type` contiguously (use `stride` to compute the offset of each
+  /// position). The buffer is zero-initialized unless `zero_initialize` is `false`, in which case
+  /// its contents are unspecified. The buffer is automatically deallocated after `action`
+  /// returns, at which point the pointer passed to the lambda is invalid. Any instance stored in
+  /// the temporary buffer must be be deinitialized before `action` returns.
+  ///
+  /// Small buffers are allocated in the scratch arena of the calling thread, so that nested
+  /// temporaries reuse the same memory. Large ones are allocated on the heap.
   ///
   /// - Requires: `type` has been declared and defined in `this`.
   template<typename A>
-  void with_temporary_allocation(TypeHeader const* type, std::size_t count, A action) const {
+  void with_temporary_allocation(
+    TypeHeader const* type, std::size_t count, A action, bool zero_initialize = true
+  ) const {
     auto s = (count == 1) ? size(type) : stride(type) * count;
-    auto a = alignment(type);
-    auto x = a - 1;
-
     if (s == 0) { return action(nullptr); }
 
-    std::byte buffer[s + x];
-    auto b = reinterpret_cast<uintptr_t>(&buffer);
-    b += b & x;
-
-    auto base_address = reinterpret_cast<void*>(b);
-    std::memset(base_address, 0, s);
+    TemporaryBuffer buffer{s, alignment(type)};
+    auto base_address = buffer.address();
+    if (zero_initialize) { std::memset(base_address, 0, s); }
     action(base_address);
   }
 
@@ -233,16 +744,107 @@ public:
   /// Initializes `target`, which points to storage for an instance of `type`, to a copy of the
   /// value stored at `source`, which is an instance of the `tag`-th case of `type`.
   ///
-  /// - Requires: `type` has been declared and defined in `this`.
-  void copy_initialize_enum(
+  /// - Requires: `type` has been declared and defined in `this`, and the value at `source` is
+  ///   fully initialized: none of its out-of-line fields is null, as a null pointer may encode
+  ///   another case of `type`. This requirement is checked in debug builds.
+  inline void copy_initialize_enum(
     EnumHeader const* type, std::size_t tag, void* target, void* source
-  ) const;
+  ) const {
+    copy_initialize_enum(type, tag, target, source, *allocator);
+  }
+
+  /// Initializes `target`, which points to storage for an instance of `type`, to a copy of the
+  /// value stored at `source`, which is an instance of the `tag`-th case of `type`, allocating
+  /// the out-of-line storage of the copy in `region`.
+  ///
+  /// Shared boxes are handled as with `copy_initialize(type, target, source, region)`.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`.
+  inline void copy_initialize_enum(
+    EnumHeader const* type, std::size_t tag, void* target, void* source, Region& region
+  ) const {
+    copy_initialize_enum(type, tag, target, source, static_cast<Allocator&>(region));
+  }
 
   /// Initializes `target` with a copy of the instance of `type` that is stored at `source`.
   ///
   /// - Requires: `type` has been declared and defined in `this`.
   inline void copy_initialize(TypeHeader const* type, void* target, void* source) const {
-    type->copy_initialize(target, source, *this);
+    xst::copy_initialize(witnesses(type), target, source, *allocator);
+  }
+
+  /// Initializes `target` with a copy of the instance of `type` that is stored at `source`,
+  /// allocating the out-of-line storage of the copy in `region`.
+  ///
+  /// The copy can be dropped with `region` rather than deinitialized. Shared boxes allocated in
+  /// `region` are shared with the original, while the others are copied into `region`, since the
+  /// references that the copy would hold on them would never be released.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`.
+  inline void copy_initialize(
+    TypeHeader const* type, void* target, void* source, Region& region
+  ) const {
+    xst::copy_initialize(witnesses(type), target, source, region);
+  }
+
+  /// Initializes `target` with a copy of the instance of `type` that is stored at `source`, using
+  /// the workers of `pool` to copy independent out-of-line parts in parallel.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`, the value allocator of `this` is
+  ///   thread-safe, and this method is not called from a task of `pool`.
+  ///
+  /// - Note: Out-of-line parts are allocated with the value allocator of `this`, which is the
+  ///   heap unless `this` was constructed with another one. Construct `this` with a
+  ///   `ThreadCachingAllocator` to give each worker a cache of its own.
+  inline void copy_initialize(
+    TypeHeader const* type, void* target, void* source, ThreadPool& pool
+  ) const {
+    xst::copy_initialize(witnesses(type), target, source, *allocator, pool);
+  }
+
+  /// Initializes the `count` contiguous instances of `type` at `target` with copies of the `count`
+  /// contiguous instances of `type` that are stored at `source`.
+  ///
+  /// Instances are laid out by `stride(type)`. The witnesses of `type` are resolved once for the
+  /// whole batch and the buffer is copied with a single `memcpy` if `type` is trivial.
+  ///
+  /// - Requires: `type` has been declared and defined in `this` and the buffers at `target` and
+  ///   `source` do not overlap.
+  inline void copy_initialize_n(
+    TypeHeader const* type, void* target, void* source, std::size_t count
+  ) const {
+    xst::copy_initialize_n(witnesses(type), target, source, count, *allocator);
+  }
+
+  /// Initializes the `count` contiguous instances of `type` at `target` with copies of the `count`
+  /// contiguous instances of `type` that are stored at `source`, allocating the out-of-line
+  /// storage of the copies in `region`.
+  ///
+  /// Shared boxes are handled as with `copy_initialize(type, target, source, region)`.
+  ///
+  /// - Requires: `type` has been declared and defined in `this` and the buffers at `target` and
+  ///   `source` do not overlap.
+  inline void copy_initialize_n(
+    TypeHeader const* type, void* target, void* source, std::size_t count, Region& region
+  ) const {
+    xst::copy_initialize_n(witnesses(type), target, source, count, region);
+  }
+
+  /// Initializes the `count` contiguous instances of `type` at `target` with copies of the `count`
+  /// contiguous instances of `type` that are stored at `source`, using the workers of `pool` to
+  /// copy instances and their independent out-of-line parts in parallel.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`, the buffers at `target` and
+  ///   `source` do not overlap, the value allocator of `this` is thread-safe, and this method is
+  ///   not called from a task of `pool`.
+  ///
+  /// - Note: Out-of-line parts are allocated with the value allocator of `this`, which is the
+  ///   heap unless `this` was constructed with another one. Construct `this` with a
+  ///   `ThreadCachingAllocator` to give each worker a cache of its own.
+  inline void copy_initialize_n(
+    TypeHeader const* type, void* target, void* source, std::size_t count, ThreadPool& pool
+  ) const {
+    xst::copy_initialize_n(witnesses(type), target, source, count, *allocator, pool);
   }
 
   /// Implements `copy_initialize` for built-in types.
@@ -256,11 +858,120 @@ public:
   /// Implements `copy_initialize` for enum types.
   void copy_initialize(EnumHeader const* h, void* target, void* source) const;
 
+  /// Initializes `target`, which points to storage for an instance of `type`, with the value
+  /// stored at `source`, which is an instance of the `tag`-th case of `type`, consuming it.
+  ///
+  /// The ownership of the out-of-line storage of the value at `source` is transferred to the
+  /// payload of `target`. `source` is left uninitialized and must not be deinitialized.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`, and the value at `source` is
+  ///   fully initialized, as with `copy_initialize_enum`.
+  inline void move_initialize_enum(
+    EnumHeader const* type, std::size_t tag, void* target, void* source
+  ) const {
+    move_initialize_enum(type, tag, target, source, *allocator);
+  }
+
+  /// Initializes `target`, which points to storage for an instance of `type`, with the value
+  /// stored at `source`, which is an instance of the `tag`-th case of `type`, consuming it and
+  /// allocating the out-of-line storage of `target`, if any, in `region`.
+  ///
+  /// - Requires: `type` has been declared and defined in `this` and the out-of-line storage of
+  ///   the value at `source` is allocated in `region`.
+  inline void move_initialize_enum(
+    EnumHeader const* type, std::size_t tag, void* target, void* source, Region& region
+  ) const {
+    move_initialize_enum(type, tag, target, source, static_cast<Allocator&>(region));
+  }
+
+  /// Initializes `target` with the instance of `type` that is stored at `source`, consuming it.
+  ///
+  /// The inline representation of the value at `source` is copied bitwise and the ownership of its
+  /// out-of-line storage is transferred to `target`, so the cost of this operation only depends on
+  /// the size of `type`. `source` is left uninitialized and must not be deinitialized.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`.
+  inline void move_initialize(TypeHeader const* type, void* target, void* source) const {
+    type->move_initialize(target, source, *this);
+  }
+
+  /// Initializes the `count` contiguous instances of `type` at `target` with the `count`
+  /// contiguous instances of `type` that are stored at `source`, consuming them.
+  ///
+  /// Instances are laid out by `stride(type)` and moved with a single `memcpy`.
+  ///
+  /// - Requires: `type` has been declared and defined in `this` and the buffers at `target` and
+  ///   `source` do not overlap.
+  inline void move_initialize_n(
+    TypeHeader const* type, void* target, void* source, std::size_t count
+  ) const {
+    auto n = witnesses(type).extent(count);
+    if (n != 0) { memcpy(target, source, n); }
+  }
+
+  /// Implements `move_initialize` for built-in types.
+  inline void move_initialize(BuiltinHeader const* h, void* target, void* source) const {
+    memcpy(target, source, size(h));
+  }
+
+  /// Implements `move_initialize` for struct types.
+  void move_initialize(StructHeader const* h, void* target, void* source) const;
+
+  /// Implements `move_initialize` for enum types.
+  void move_initialize(EnumHeader const* h, void* target, void* source) const;
+
   /// Destroys the instance of `type` that is stored at `source`.
   ///
   /// - Requires: `type` has been declared and defined in `this`.
   inline void deinitialize(TypeHeader const* type, void* source) const {
-    type->deinitialize(source, *this);
+    xst::deinitialize(witnesses(type), source, *allocator);
+  }
+
+  /// Destroys the instance of `type` that is stored at `source`, whose out-of-line storage is
+  /// allocated in `region`.
+  ///
+  /// This method is a no-op: the parts of the instance are released when `region` is destroyed.
+  ///
+  /// - Requires: `type` has been declared and defined in `this` and the out-of-line storage of
+  ///   the value at `source` is allocated in `region`.
+  inline void deinitialize(TypeHeader const*, void*, Region&) const {}
+
+  /// Destroys the instance of `type` that is stored at `source`, using the workers of `pool` to
+  /// destroy independent out-of-line parts in parallel.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`, the value allocator of `this` is
+  ///   thread-safe, and this method is not called from a task of `pool`.
+  ///
+  /// - Note: Out-of-line parts are released to the value allocator of `this`, which is the heap
+  ///   unless `this` was constructed with another one. Construct `this` with a
+  ///   `ThreadCachingAllocator` to give each worker a cache of its own.
+  inline void deinitialize(TypeHeader const* type, void* source, ThreadPool& pool) const {
+    xst::deinitialize(witnesses(type), source, *allocator, pool);
+  }
+
+  /// Destroys the `count` contiguous instances of `type` that are stored at `source`.
+  ///
+  /// Instances are laid out by `stride(type)`. The witnesses of `type` are resolved once for the
+  /// whole batch and nothing is done if `type` is trivial.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`.
+  inline void deinitialize_n(TypeHeader const* type, void* source, std::size_t count) const {
+    xst::deinitialize_n(witnesses(type), source, count, *allocator);
+  }
+
+  /// Destroys the `count` contiguous instances of `type` that are stored at `source`, using the
+  /// workers of `pool` to destroy instances and their independent out-of-line parts in parallel.
+  ///
+  /// - Requires: `type` has been declared and defined in `this`, the value allocator of `this` is
+  ///   thread-safe, and this method is not called from a task of `pool`.
+  ///
+  /// - Note: Out-of-line parts are released to the value allocator of `this`, which is the heap
+  ///   unless `this` was constructed with another one. Construct `this` with a
+  ///   `ThreadCachingAllocator` to give each worker a cache of its own.
+  inline void deinitialize_n(
+    TypeHeader const* type, void* source, std::size_t count, ThreadPool& pool
+  ) const {
+    xst::deinitialize_n(witnesses(type), source, count, *allocator, pool);
   }
 
   /// Implements `deinitialize` for built-in types.
@@ -277,28 +988,43 @@ public:
   /// - Requires: the type of `field` has been declared and defined in `this`.
   void deinitialize(Field const& field, void* source) const;
 
+  /// Returns `true` iff the instances of `type` stored at `a` and `b` are equal.
+  ///
+  /// Two instances are equal if they have the same case, for sum types, and if their parts are
+  /// pairwise equal. Out-of-line parts are compared by value. Instances of types whose
+  /// representation has no padding and no out-of-line storage are compared bitwise.
+  ///
+  /// - Requires: `type` has been declared and defined in `this` and `a` and `b` are initialized.
+  bool equal_instances(TypeHeader const* type, void* a, void* b) const;
+
+  /// Returns a hash of the instance of `type` stored at `source`.
+  ///
+  /// The result is equal for instances that are equal according to `equal_instances`.
+  ///
+  /// - Requires: `type` has been declared and defined in `this` and `source` is initialized.
+  std::size_t hash_instance(TypeHeader const* type, void* source) const;
+
+  /// Appends to `output` a textual representation of the value stored at `source`, which is an
+  /// instance of `type`.
+  ///
+  /// - Requires: `type` has been declared and defined in `this` and `source` is initialzed.
+  void dump_instance(OutputBuffer& output, TypeHeader const* type, void* source) const;
+
   /// Writes to `stream` a textual representation of the value stored at `source`, which is an
   /// instance of `type`.
   ///
   /// - Requires: `type` has been declared and defined in `this` and `source` is initialzed.
   inline void dump_instance(std::ostream& stream, TypeHeader const* type, void* source) const {
-    type->dump_instance(stream, source, *this);
+    OutputBuffer o;
+    dump_instance(o, type, source);
+    stream << o.view();
   }
 
-  /// Implements `dump_instance` for built-in types.
-  void dump_instance(std::ostream& stream, BuiltinHeader const* type, void* source) const;
-
-  /// Implements `dump_instance` for struct types.
-  void dump_instance(std::ostream& stream, StructHeader const* type, void* source) const;
-
-  /// Implements `dump_instance` for enum types.
-  void dump_instance(std::ostream& stream, EnumHeader const* type, void* source) const;
-
   /// Returns a description of the value stored at `source`, which is an instance of `type`.
   inline std::string describe_instance(TypeHeader const* type, void* source) const {
-    std::stringstream o;
+    OutputBuffer o;
     dump_instance(o, type, source);
-    return o.str();
+    return std::move(o.contents);
   }
 
 };
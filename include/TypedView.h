@@ -0,0 +1,258 @@
+#pragma once
+
+#include "TypeStore.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace xst {
+
+/// Marks a field that is stored out-of-line in a box containing an instance of `T`, or of any
+/// type if `T` is `void`.
+template<typename T>
+struct Boxed {};
+
+template<typename... Fields>
+struct TypedLayout;
+
+/// `true` iff `T` is a specialization of `TypedLayout`.
+template<typename T>
+constexpr bool is_typed_layout = false;
+
+template<typename... Fields>
+constexpr bool is_typed_layout<TypedLayout<Fields...>> = true;
+
+/// The static description of a field whose values are instances of `T` stored inline.
+///
+/// A field whose values are instances of a struct is described by the `TypedLayout` of that
+/// struct.
+template<typename T>
+struct StaticField {
+
+  static_assert(std::is_trivially_copyable_v<T>, "inline fields must be trivially copyable");
+
+  /// The type of the values accessed through the field.
+  using Value = T;
+
+  /// `true` iff the field is stored out-of-line.
+  static constexpr bool out_of_line = false;
+
+  /// The size of the field in the inline representation of an instance.
+  static constexpr std::size_t size = sizeof(T);
+
+  /// The alignment of the field in the inline representation of an instance.
+  static constexpr std::size_t alignment = alignof(T);
+
+};
+
+/// The static description of a field whose values are instances of `T` stored out-of-line.
+template<typename T>
+struct StaticField<Boxed<T>> {
+
+  /// The type of the values accessed through the field.
+  using Value = T;
+
+  /// `true` iff the field is stored out-of-line.
+  static constexpr bool out_of_line = true;
+
+  /// The size of the field in the inline representation of an instance.
+  static constexpr std::size_t size = sizeof(void*);
+
+  /// The alignment of the field in the inline representation of an instance.
+  static constexpr std::size_t alignment = alignof(void*);
+
+};
+
+/// The layout of a struct whose fields are described by `Fields`, laid out in declaration order
+/// like `TypeStore::declaration_order` does, computed at compile time.
+template<typename... Fields>
+struct StaticLayout {
+
+  /// The number of fields.
+  static constexpr std::size_t count = sizeof...(Fields);
+
+  /// The description of the `i`-th field.
+  template<std::size_t i>
+  using Field = StaticField<std::tuple_element_t<i, std::tuple<Fields...>>>;
+
+  /// The offset of each field.
+  static constexpr std::array<std::size_t, count> offsets = [] {
+    std::array<std::size_t, count> result{};
+    std::size_t sizes[] = {StaticField<Fields>::size..., 0};
+    std::size_t alignments[] = {StaticField<Fields>::alignment..., 1};
+    std::size_t p = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+      result[i] = round_up_to_nearest_multiple(p, alignments[i]);
+      p = result[i] + sizes[i];
+    }
+    return result;
+  }();
+
+  /// The size of an instance.
+  static constexpr std::size_t size = [] {
+    std::size_t sizes[] = {StaticField<Fields>::size..., 0};
+    std::size_t result = 0;
+    for (std::size_t i = 0; i < count; ++i) { result = std::max(result, offsets[i] + sizes[i]); }
+    return result;
+  }();
+
+  /// The alignment of an instance.
+  static constexpr std::size_t alignment =
+    std::max({std::size_t{1}, StaticField<Fields>::alignment...});
+
+};
+
+/// The static description of a field whose values are instances of a struct whose fields are
+/// described by `Fields`, stored inline.
+template<typename... Fields>
+struct StaticField<TypedLayout<Fields...>> {
+
+  /// The type of the values accessed through the field.
+  using Value = TypedLayout<Fields...>;
+
+  /// `true` iff the field is stored out-of-line.
+  static constexpr bool out_of_line = false;
+
+  /// The size of the field in the inline representation of an instance.
+  static constexpr std::size_t size = StaticLayout<Fields...>::size;
+
+  /// The alignment of the field in the inline representation of an instance.
+  static constexpr std::size_t alignment = StaticLayout<Fields...>::alignment;
+
+};
+
+template<typename... Fields>
+struct TypedView;
+
+/// The binding of a static layout to a struct type of a store, whose runtime layout is checked
+/// once when the binding is created.
+///
+/// Inline fields are accessed at offsets known at compile time, without going through the store.
+/// Out-of-line fields are accessed through `TypeStore::address_of`.
+///
+/// A field described by a native type only binds to a trivial type that isn't a struct or an
+/// enum, so that the bits of its instances can be accessed as values of the native type. A field
+/// described by a `TypedLayout` binds to a struct whose fields are described by that layout.
+template<typename... Fields>
+struct TypedLayout {
+
+  /// The static layout of the bound type.
+  using Layout = StaticLayout<Fields...>;
+
+  /// The store containing the bound type.
+  TypeStore const& store;
+
+  /// The metatype of the bound type.
+  Metatype const& metatype;
+
+  /// Creates an instance binding `Fields` to `type`, or throws an exception if the layout of
+  /// `type` in `store` isn't described by `Fields`.
+  ///
+  /// - Requires: `type` has been declared and defined in `store`.
+  TypedLayout(
+    TypeStore const& store, TypeHeader const* type
+  ) : store(store), metatype(store[type]) {
+    if (!describes(store, type)) {
+      throw std::invalid_argument(type->description() + " doesn't have the expected layout");
+    }
+  }
+
+  /// Returns `true` iff the layout of `type` in `store` is described by `Fields`.
+  ///
+  /// - Requires: `type` has been declared in `store`.
+  static bool describes(TypeStore const& store, TypeHeader const* type) {
+    auto fields = std::make_index_sequence<Layout::count>{};
+    return (type->kind == TypeHeader::product) && matches(store, store[type], fields);
+  }
+
+  /// Returns a view of the instance at `base`.
+  ///
+  /// - Requires: `base` is the address of an instance of the bound type.
+  inline TypedView<Fields...> view(void* base) const {
+    return {*this, static_cast<std::byte*>(base)};
+  }
+
+private:
+
+  /// Returns `true` iff the fields of `metatype`, which is in `store`, are described by `Fields`.
+  template<std::size_t... i>
+  static bool matches(
+    TypeStore const& store, Metatype const& metatype, std::index_sequence<i...>
+  ) {
+    return
+      (metatype.fields().size() == Layout::count) &&
+      (metatype.size() == Layout::size) && (metatype.alignment() == Layout::alignment) &&
+      (matches<i>(store, metatype) && ...);
+  }
+
+  /// Returns `true` iff the `i`-th field of `metatype`, which is in `store`, is described by
+  /// `Field<i>`.
+  template<std::size_t i>
+  static bool matches(TypeStore const& store, Metatype const& metatype) {
+    using F = typename Layout::template Field<i>;
+    auto const& f = metatype.fields()[i];
+    if ((f.out_of_line() != F::out_of_line) || (metatype.offsets()[i] != Layout::offsets[i])) {
+      return false;
+    }
+
+    using V = typename F::Value;
+    if constexpr (std::is_void_v<V>) {
+      return true;
+    } else if constexpr (is_typed_layout<V>) {
+      return V::describes(store, f.type());
+    } else {
+      auto k = f.type()->kind;
+      return (k != TypeHeader::sum) && (k != TypeHeader::product) && store.is_trivial(f.type())
+        && (store.size(f.type()) == sizeof(V)) && (store.alignment(f.type()) == alignof(V));
+    }
+  }
+
+};
+
+/// A view of an instance of a struct type bound to the static layout `Fields`.
+template<typename... Fields>
+struct TypedView {
+
+  /// The binding of the type of the instance.
+  TypedLayout<Fields...> const& layout;
+
+  /// The address of the instance.
+  std::byte* base;
+
+  /// The offset of the `i`-th field.
+  template<std::size_t i>
+  static constexpr std::size_t offset = StaticLayout<Fields...>::offsets[i];
+
+  /// Returns the address of the `i`-th field of the instance, or of the value in its box if it is
+  /// stored out-of-line.
+  ///
+  /// Out-of-line storage is allocated, or copied if it is shared, as with `TypeStore::address_of`.
+  /// The address of a field described by a `TypedLayout` is returned as a `std::byte*`, to be
+  /// viewed through that layout.
+  template<std::size_t i>
+  inline auto address() const {
+    using F = typename StaticLayout<Fields...>::template Field<i>;
+    using V = std::conditional_t<is_typed_layout<typename F::Value>, std::byte, typename F::Value>;
+    if constexpr (F::out_of_line) {
+      return static_cast<V*>(layout.store.address_of(layout.metatype, i, base));
+    } else {
+      return reinterpret_cast<V*>(base + offset<i>);
+    }
+  }
+
+  /// Returns the value of the `i`-th field of the instance.
+  ///
+  /// - Requires: the `i`-th field isn't an untyped box and isn't described by a `TypedLayout`.
+  template<std::size_t i>
+  inline auto& get() const {
+    return *address<i>();
+  }
+
+};
+
+}
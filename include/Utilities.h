@@ -1,8 +1,11 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <numeric>
+#include <span>
 #include <sstream>
+#include <string_view>
 #include <type_traits>
 #include <utility>
 
@@ -48,26 +51,49 @@ std::string descriptions(Iterator first, Iterator last, std::string const& separ
 // --- Hashing ------------------------------------------------------------------------------------
 
 /// A utility for hashing contents.
+///
+/// The contents of a hasher are mixed one 64-bit word at a time, using the multiply-and-fold
+/// function of wyhash.
 struct Hasher {
 
-  static constexpr int64_t basis = 0xcbf29ce484222325;
-  static constexpr int64_t prime = 0x100000001b3;
+  /// The constants used to mix contents into the state of a hasher.
+  static constexpr uint64_t secret[] = {
+    0xa0761d6478bd642f, 0xe7037ed1a0b428db, 0x8ebc6af09c88c6e3, 0x589965cc75374cc3
+  };
 
   /// The current state of the hasher.
-  int64_t state;
+  uint64_t state;
 
   /// Creates a new instance.
-  constexpr Hasher() : state(basis) {}
+  constexpr Hasher() : state(secret[0]) {}
+
+  /// Returns the exclusive or of the high and low halves of the product of `a` and `b`.
+  static constexpr uint64_t mix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    auto r = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+    uint64_t ha = a >> 32, la = static_cast<uint32_t>(a);
+    uint64_t hb = b >> 32, lb = static_cast<uint32_t>(b);
+    uint64_t hi = ha * hb, mid0 = ha * lb, mid1 = la * hb, lo = la * lb;
+    uint64_t t = lo + (mid0 << 32);
+    uint64_t c = t < lo;
+    uint64_t low = t + (mid1 << 32);
+    c += low < t;
+    uint64_t high = hi + (mid0 >> 32) + (mid1 >> 32) + c;
+    return low ^ high;
+#endif
+  }
+
+  /// Combines `word` into the state of this hasher.
+  constexpr void combine_word(uint64_t word) {
+    state = mix(state ^ secret[1], word ^ secret[2]);
+  }
 
   /// Combines a hash of `contents` into the state of this hasher.
   template<typename T, typename Hash = std::hash<T>>
   constexpr void combine(T const& contents) {
-    std::size_t h = Hash{}(contents);
-    for (auto i = 0; i < sizeof(std::size_t); ++i) {
-      state = state * Hasher::prime;
-      state = state ^ (h & 0xff);
-      h = h >> 8;
-    }
+    combine_word(static_cast<uint64_t>(Hash{}(contents)));
   }
 
   /// Combines a hash of `contents` into the state of this hasher.
@@ -83,9 +109,41 @@ struct Hasher {
     }
   }
 
+  /// Combines the hashes of `headers` into the state of this hasher, followed by their number.
+  ///
+  /// `Header` is any type whose instances have a `hash_value()` method, such as `TypeHeader`.
+  template<typename Header>
+  constexpr void combine_hashes(std::span<Header const* const> headers) {
+    for (auto h : headers) { combine_word(static_cast<uint64_t>(h->hash_value())); }
+    combine_word(static_cast<uint64_t>(headers.size()));
+  }
+
+  /// Combines `hashes` into the state of this hasher, followed by their number.
+  constexpr void combine_hashes(std::span<std::size_t const> hashes) {
+    for (auto h : hashes) { combine_word(static_cast<uint64_t>(h)); }
+    combine_word(static_cast<uint64_t>(hashes.size()));
+  }
+
+  /// Combines the bytes of `contents` into the state of this hasher, eight at a time.
+  inline void combine_bytes(std::string_view contents) {
+    auto n = contents.size();
+    std::size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+      uint64_t w;
+      std::memcpy(&w, contents.data() + i, sizeof(uint64_t));
+      combine_word(w);
+    }
+    if (i < n) {
+      uint64_t w = 0;
+      std::memcpy(&w, contents.data() + i, n - i);
+      combine_word(w);
+    }
+    combine_word(static_cast<uint64_t>(n));
+  }
+
   /// Returns the final value of the hasher.
   constexpr std::size_t finalize() {
-    return truncate_or_extend<int64_t, std::size_t>(state);
+    return static_cast<std::size_t>(mix(state, secret[3]));
   }
 
 };
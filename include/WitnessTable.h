@@ -0,0 +1,224 @@
+#pragma once
+
+#include "Allocator.h"
+#include "Statistics.h"
+#include "TagEncoding.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace xst {
+
+/// A flattened description of the operations necessary to copy and destroy instances of a type.
+///
+/// An instance is copied by copying its inline representation bitwise and then applying the
+/// operations of its table to the parts that aren't trivially copyable. It is destroyed by applying
+/// the operations of its table. The operations of a product type include those of the inline
+/// product types that it contains, so that only out-of-line fields and sum types require going
+/// through another table.
+struct WitnessTable {
+
+  /// An operation on a part of an instance that is not trivially copyable.
+  struct Operation {
+
+    /// The kind of an operation.
+    enum Kind : uint8_t {
+
+      /// The part is a pointer to an instance stored out-of-line, described by `witnesses`.
+      box,
+
+      /// The part is an inline instance of the sum type described by `witnesses`.
+      sum,
+
+      /// The part is a pointer to an instance stored out-of-line in a reference-counted box,
+      /// described by `witnesses`.
+      shared_box,
+
+    };
+
+    /// The kind of this operation.
+    Kind kind;
+
+    /// The offset of the part on which this operation applies.
+    std::size_t offset;
+
+    /// The table describing the part on which this operation applies.
+    WitnessTable const* witnesses;
+
+  };
+
+  /// The size of an instance.
+  std::size_t size = 0;
+
+  /// The alignment of an instance.
+  std::size_t alignment = 1;
+
+  /// `true` iff two instances are equal if and only if their inline representations are bitwise
+  /// equal, which holds for trivial types whose representation has no padding or spare bits.
+  bool bitwise_equatable = false;
+
+  /// The operations to apply on an instance after its inline representation has been copied, or
+  /// before it is deallocated.
+  ///
+  /// The table of a sum type has a single operation, of kind `sum`, referring to itself unless the
+  /// type is trivial.
+  std::span<Operation const> operations;
+
+  /// The way the case of an instance is represented, if the type is a sum.
+  TagEncoding tag;
+
+  /// The operations to apply on the payload of each case, if the type is a sum.
+  std::span<std::span<Operation const> const> cases;
+
+#if defined(XST_STATISTICS)
+  /// The statistics in which the events on instances are recorded, if any.
+  Statistics* statistics = nullptr;
+
+  /// The ID of the described type in the store owning `statistics`.
+  std::size_t type = 0;
+#endif
+
+  /// Records `n` occurrences of `e` on the described type.
+  ///
+  /// This method is a no-op unless `XST_STATISTICS` is defined.
+  inline void record(
+    [[maybe_unused]] Statistics::Event e, [[maybe_unused]] uint64_t n = 1
+  ) const {
+#if defined(XST_STATISTICS)
+    if (statistics != nullptr) { statistics->record(e, type, n); }
+#endif
+  }
+
+  /// Returns the number of bytes from the start of one instance to the start of the next when
+  /// stored in contiguous memory.
+  inline std::size_t stride() const {
+    auto x = (size + alignment - 1) & ~(alignment - 1);
+    return x < 1 ? 1 : x;
+  }
+
+  /// Returns the number of bytes spanned by `count` contiguous instances.
+  inline std::size_t extent(std::size_t count) const {
+    return (count == 0) ? 0 : (count - 1) * stride() + size;
+  }
+
+  /// Returns the case of the instance at `source`.
+  ///
+  /// - Requires: `this` describes a sum type.
+  inline std::size_t case_of(void const* source) const {
+    return tag.case_of(source);
+  }
+
+};
+
+/// Returns the pointer stored at `p`, which needn't be aligned.
+inline void* load_pointer(std::byte const* p) {
+  void* result;
+  std::memcpy(&result, p, sizeof(void*));
+  return result;
+}
+
+/// Stores `value` at `p`.
+inline void store_pointer(std::byte* p, void* value) {
+  std::memcpy(p, &value, sizeof(void*));
+}
+
+/// Returns the address stored in the out-of-line fields whose type has no size.
+///
+/// The out-of-line fields of an initialized value are never null, so that a null pointer is a
+/// spare value that can represent a case of a sum type.
+inline void* empty_box() {
+  alignas(std::max_align_t) static std::byte storage[1];
+  return storage;
+}
+
+/// The number of references to a shared box.
+///
+/// A shared box is allocated with its reference count immediately before its payload, which is
+/// the address stored in the fields referring to the box.
+using ReferenceCount = std::atomic<std::size_t>;
+
+/// Returns the reference count of the shared box whose payload is at `payload`.
+inline ReferenceCount& reference_count(void* payload) {
+  return *reinterpret_cast<ReferenceCount*>(
+    static_cast<std::byte*>(payload) - sizeof(ReferenceCount));
+}
+
+/// Returns the address of the uninitialized payload of a new shared box allocated by `allocator`
+/// to store an instance described by `witnesses`, whose reference count is one, or `empty_box()`
+/// if that instance has no size.
+void* allocate_shared_box(WitnessTable const& witnesses, Allocator& allocator);
+
+/// Decrements the reference count of the shared box whose payload is at `payload`, destroying its
+/// contents and deallocating it with `allocator` if that was the last reference.
+///
+/// This function is a no-op if `payload` is `nullptr` or if the instance has no size.
+void release_shared_box(WitnessTable const& witnesses, void* payload, Allocator& allocator);
+
+/// Initializes `target` with a copy of the instance described by `witnesses` that is stored at
+/// `source`, using `allocator` to allocate out-of-line storage.
+void copy_initialize(
+  WitnessTable const& witnesses, void* target, void const* source, Allocator& allocator);
+
+/// Destroys the instance described by `witnesses` that is stored at `source`, using `allocator` to
+/// deallocate out-of-line storage.
+void deinitialize(WitnessTable const& witnesses, void* source, Allocator& allocator);
+
+/// Initializes the `count` contiguous instances at `target` with copies of the `count` contiguous
+/// instances described by `witnesses` that are stored at `source`, using `allocator` to allocate
+/// out-of-line storage.
+///
+/// - Requires: the buffers at `target` and `source` do not overlap.
+void copy_initialize_n(
+  WitnessTable const& witnesses, void* target, void const* source, std::size_t count,
+  Allocator& allocator);
+
+/// Destroys the `count` contiguous instances described by `witnesses` that are stored at `source`,
+/// using `allocator` to deallocate out-of-line storage.
+void deinitialize_n(
+  WitnessTable const& witnesses, void* source, std::size_t count, Allocator& allocator);
+
+/// Initializes `target` with a copy of the instance described by `witnesses` that is stored at
+/// `source`, using `allocator` to allocate out-of-line storage and the workers of `pool` to copy
+/// independent out-of-line parts in parallel.
+///
+/// A task only hands over work to other workers once it has copied a few hundred parts, so small
+/// instances are copied by the calling thread alone.
+///
+/// - Requires: `allocator` is thread-safe, and this function is not called from a task of `pool`.
+void copy_initialize(
+  WitnessTable const& witnesses, void* target, void const* source, Allocator& allocator,
+  ThreadPool& pool);
+
+/// Destroys the instance described by `witnesses` that is stored at `source`, using `allocator`
+/// to deallocate out-of-line storage and the workers of `pool` to destroy independent out-of-line
+/// parts in parallel.
+///
+/// - Requires: `allocator` is thread-safe, and this function is not called from a task of `pool`.
+void deinitialize(
+  WitnessTable const& witnesses, void* source, Allocator& allocator, ThreadPool& pool);
+
+/// Initializes the `count` contiguous instances at `target` with copies of the `count` contiguous
+/// instances described by `witnesses` that are stored at `source`, using `allocator` to allocate
+/// out-of-line storage and the workers of `pool` to copy instances and their independent
+/// out-of-line parts in parallel.
+///
+/// - Requires: the buffers at `target` and `source` do not overlap, `allocator` is thread-safe,
+///   and this function is not called from a task of `pool`.
+void copy_initialize_n(
+  WitnessTable const& witnesses, void* target, void const* source, std::size_t count,
+  Allocator& allocator, ThreadPool& pool);
+
+/// Destroys the `count` contiguous instances described by `witnesses` that are stored at `source`,
+/// using `allocator` to deallocate out-of-line storage and the workers of `pool` to destroy
+/// instances and their independent out-of-line parts in parallel.
+///
+/// - Requires: `allocator` is thread-safe, and this function is not called from a task of `pool`.
+void deinitialize_n(
+  WitnessTable const& witnesses, void* source, std::size_t count, Allocator& allocator,
+  ThreadPool& pool);
+
+}
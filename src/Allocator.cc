@@ -0,0 +1,141 @@
+#include "Allocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <utility>
+
+namespace xst {
+
+Allocator& Allocator::heap() {
+  static HeapAllocator instance;
+  return instance;
+}
+
+void* HeapAllocator::allocate(std::size_t size, std::size_t alignment) {
+  return ::operator new(size, std::align_val_t{alignment});
+}
+
+void HeapAllocator::deallocate(void* p, std::size_t size, std::size_t alignment) {
+  ::operator delete(p, size, std::align_val_t{alignment});
+}
+
+PoolAllocator::~PoolAllocator() {
+  for (auto s : slabs) {
+    ::operator delete(s, std::align_val_t{granule});
+  }
+}
+
+void PoolAllocator::refill(std::size_t c) {
+  auto s = ::operator new(slab_size, std::align_val_t{granule});
+  slabs.push_back(s);
+
+  auto block_size = (c + 1) * granule;
+  auto base = static_cast<std::byte*>(s);
+  auto head = free_lists[c];
+  for (auto i = slab_size / block_size; i > 0; --i) {
+    auto b = reinterpret_cast<Block*>(base + (i - 1) * block_size);
+    b->next = head;
+    head = b;
+  }
+  free_lists[c] = head;
+}
+
+void* PoolAllocator::allocate(std::size_t size, std::size_t alignment) {
+  if (!pooled(size, alignment)) { return Allocator::heap().allocate(size, alignment); }
+
+  void* p = nullptr;
+  allocate_blocks(class_of(size), &p, 1);
+  return p;
+}
+
+void PoolAllocator::deallocate(void* p, std::size_t size, std::size_t alignment) {
+  if (!pooled(size, alignment)) { return Allocator::heap().deallocate(p, size, alignment); }
+  deallocate_blocks(class_of(size), &p, 1);
+}
+
+std::size_t PoolAllocator::allocate_blocks(std::size_t c, void** blocks, std::size_t n) {
+  std::lock_guard<std::mutex> l{mutex};
+  if (free_lists[c] == nullptr) { refill(c); }
+
+  std::size_t i = 0;
+  for (auto b = free_lists[c]; (b != nullptr) && (i < n); b = free_lists[c]) {
+    free_lists[c] = b->next;
+    blocks[i++] = b;
+  }
+  return i;
+}
+
+void PoolAllocator::deallocate_blocks(std::size_t c, void* const* blocks, std::size_t n) {
+  std::lock_guard<std::mutex> l{mutex};
+  for (std::size_t i = 0; i < n; ++i) {
+    auto b = static_cast<Block*>(blocks[i]);
+    b->next = free_lists[c];
+    free_lists[c] = b;
+  }
+}
+
+/// The source of the identities of thread-caching allocators.
+static std::atomic<std::uint64_t> next_allocator_identity{1};
+
+ThreadCachingAllocator::ThreadCachingAllocator(
+  std::size_t cache_capacity
+) :
+  identity(next_allocator_identity.fetch_add(1)),
+  cache_capacity(std::max<std::size_t>(cache_capacity, 2))
+{}
+
+ThreadCachingAllocator::~ThreadCachingAllocator() = default;
+
+ThreadCachingAllocator::Cache& ThreadCachingAllocator::local_cache() {
+  // Identities are never reused, so the entries of destroyed allocators are never matched again.
+  thread_local std::vector<std::pair<std::uint64_t, Cache*>> local;
+  if (!local.empty() && (local.back().first == identity)) { return *local.back().second; }
+
+  // Move the entry of this instance last so that it's found immediately next time.
+  for (auto& e : local) {
+    if (e.first == identity) {
+      std::swap(e, local.back());
+      return *local.back().second;
+    }
+  }
+
+  std::lock_guard<std::mutex> l{mutex};
+  caches.push_back(std::make_unique<Cache>());
+  local.emplace_back(identity, caches.back().get());
+  return *caches.back();
+}
+
+void* ThreadCachingAllocator::allocate(std::size_t size, std::size_t alignment) {
+  if (!PoolAllocator::pooled(size, alignment)) {
+    return Allocator::heap().allocate(size, alignment);
+  }
+
+  auto c = PoolAllocator::class_of(size);
+  auto& bin = local_cache().bins[c];
+  if (bin.empty()) {
+    bin.resize(cache_capacity / 2);
+    bin.resize(pool.allocate_blocks(c, bin.data(), bin.size()));
+  }
+
+  auto p = bin.back();
+  bin.pop_back();
+  return p;
+}
+
+void ThreadCachingAllocator::deallocate(void* p, std::size_t size, std::size_t alignment) {
+  if (!PoolAllocator::pooled(size, alignment)) {
+    return Allocator::heap().deallocate(p, size, alignment);
+  }
+
+  auto c = PoolAllocator::class_of(size);
+  auto& bin = local_cache().bins[c];
+  if (bin.size() >= cache_capacity) {
+    auto n = cache_capacity / 2;
+    pool.deallocate_blocks(c, bin.data() + bin.size() - n, n);
+    bin.resize(bin.size() - n);
+  }
+  bin.push_back(p);
+}
+
+}
@@ -0,0 +1,50 @@
+#include "Arena.h"
+
+namespace xst {
+
+Arena::~Arena() {
+  for (auto f = finalizers; f != nullptr; f = f->next) {
+    f->destroy(f->object);
+  }
+
+  auto c = chunks;
+  while (c != nullptr) {
+    auto n = c->next;
+    ::operator delete(c, std::align_val_t{alignof(std::max_align_t)});
+    c = n;
+  }
+}
+
+bool Arena::contains(void const* p) const {
+  auto a = reinterpret_cast<uintptr_t>(p);
+  for (auto c = chunks; c != nullptr; c = c->next) {
+    auto first = reinterpret_cast<uintptr_t>(c + 1);
+    if ((a >= first) && (a < first + c->capacity)) { return true; }
+  }
+  return false;
+}
+
+void* Arena::allocate_slow(std::size_t s, std::size_t a) {
+  // Allocations taking more than a quarter of a regular chunk get a dedicated chunk so that the
+  // remainder of the current one isn't wasted.
+  auto dedicated = (s + a) > (chunk_size / 4);
+  auto capacity = dedicated ? (s + a) : chunk_size;
+
+  auto c = static_cast<Chunk*>(::operator new(
+    sizeof(Chunk) + capacity, std::align_val_t{alignof(std::max_align_t)}));
+  c->next = chunks;
+  c->capacity = capacity;
+  chunks = c;
+
+  auto first = reinterpret_cast<std::byte*>(c + 1);
+  auto p = reinterpret_cast<uintptr_t>(first);
+  auto q = (p + (a - 1)) & ~(static_cast<uintptr_t>(a) - 1);
+
+  if (!dedicated) {
+    cursor = reinterpret_cast<std::byte*>(q + s);
+    limit = first + capacity;
+  }
+  return reinterpret_cast<void*>(q);
+}
+
+}
@@ -0,0 +1,92 @@
+#include "ColumnarBuffer.h"
+
+#include <cstring>
+
+namespace xst {
+
+ColumnarBuffer::ColumnarBuffer(
+  TypeStore const& store, StructHeader const* type, std::size_t capacity
+) : store(store), row_type(type), row_count(capacity) {
+  auto const& m = store[type];
+  auto fields = m.fields();
+  auto offsets = m.offsets();
+
+  // Compute the layout of each column.
+  std::vector<std::size_t> column_offsets;
+  for (std::size_t i = 0; i < fields.size(); ++i) {
+    auto const& f = fields[i];
+    WitnessTable const* w;
+
+    // Elements of out-of-line fields are boxes, copied through a table of their own.
+    if (f.out_of_line()) {
+      auto k = f.shared() ? WitnessTable::Operation::shared_box : WitnessTable::Operation::box;
+      auto& b = *box_witnesses.emplace_back(new BoxWitnesses);
+      b.operation = {k, 0, &store.witnesses(f.type())};
+      b.table.size = sizeof(void*);
+      b.table.alignment = alignof(void*);
+      b.table.operations = {&b.operation, 1};
+      w = &b.table;
+    } else {
+      w = &store.witnesses(f.type());
+    }
+
+    auto o = round_up_to_nearest_multiple(storage_size, column_alignment);
+    column_offsets.push_back(o);
+    columns.push_back({nullptr, w->stride(), offsets[i], w});
+    storage_size = o + w->extent(capacity);
+  }
+
+  // Allocate the columns.
+  if (storage_size != 0) {
+    storage = ::operator new(storage_size, std::align_val_t{column_alignment});
+    std::memset(storage, 0, storage_size);
+  }
+  for (std::size_t i = 0; i < columns.size(); ++i) {
+    columns[i].base = static_cast<std::byte*>(storage) + column_offsets[i];
+  }
+}
+
+ColumnarBuffer::~ColumnarBuffer() {
+  if (storage != nullptr) {
+    ::operator delete(storage, std::align_val_t{column_alignment});
+  }
+}
+
+void ColumnarBuffer::copy_initialize_column(
+  std::size_t i, std::size_t first, std::size_t count, void const* source
+) {
+  auto const& c = columns[i];
+  xst::copy_initialize_n(
+    *c.witnesses, element_address(i, first), source, count, store.value_allocator());
+}
+
+void ColumnarBuffer::deinitialize_column(std::size_t i, std::size_t first, std::size_t count) {
+  auto const& c = columns[i];
+  xst::deinitialize_n(*c.witnesses, element_address(i, first), count, store.value_allocator());
+}
+
+void ColumnarBuffer::copy_initialize_row(std::size_t row, void const* source) {
+  auto s = static_cast<std::byte const*>(source);
+  for (std::size_t i = 0; i < columns.size(); ++i) {
+    auto const& c = columns[i];
+    xst::copy_initialize(
+      *c.witnesses, element_address(i, row), s + c.offset, store.value_allocator());
+  }
+}
+
+void ColumnarBuffer::copy_row(std::size_t row, void* target) const {
+  auto t = static_cast<std::byte*>(target);
+  for (std::size_t i = 0; i < columns.size(); ++i) {
+    auto const& c = columns[i];
+    xst::copy_initialize(
+      *c.witnesses, t + c.offset, element_address(i, row), store.value_allocator());
+  }
+}
+
+void ColumnarBuffer::deinitialize(std::size_t first, std::size_t count) {
+  for (std::size_t i = 0; i < columns.size(); ++i) {
+    deinitialize_column(i, first, count);
+  }
+}
+
+}
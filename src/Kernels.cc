@@ -0,0 +1,411 @@
+#include "Kernels.h"
+#include "Utilities.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define XST_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define XST_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+namespace xst {
+
+// --- Portable kernels ---------------------------------------------------------------------------
+
+/// The number of bytes of the patterns used to fill buffers with vector stores.
+constexpr std::size_t pattern_size = 64;
+
+/// Writes copies of the `width` bytes at `value` to `pattern` and returns `true` if `width`
+/// divides `pattern_size`. Otherwise, returns `false`.
+inline bool make_pattern(std::byte* pattern, void const* value, std::size_t width) {
+  if ((width == 0) || (pattern_size % width != 0)) { return false; }
+  for (std::size_t o = 0; o < pattern_size; o += width) {
+    std::memcpy(pattern + o, value, width);
+  }
+  return true;
+}
+
+void fill_portable(void* target, void const* value, std::size_t width, std::size_t count) {
+  auto t = static_cast<std::byte*>(target);
+  if (width == 1) {
+    std::memset(t, *static_cast<unsigned char const*>(value), count);
+  } else {
+    for (std::size_t i = 0; i < count; ++i) { std::memcpy(t + i * width, value, width); }
+  }
+}
+
+bool equal_portable(void const* a, void const* b, std::size_t n) {
+  return (n == 0) || (std::memcmp(a, b, n) == 0);
+}
+
+/// Returns the 64-bit word stored at `p`.
+inline uint64_t load_word(std::byte const* p) {
+  uint64_t result;
+  std::memcpy(&result, p, sizeof(uint64_t));
+  return result;
+}
+
+// Each stripe is read as four words. The `i`-th word is multiplied by itself after being XORed
+// with `Hasher::secret[i]` (low half times high half) and the product is added to the `i`-th lane.
+// The word itself is added to the neighboring lane `i ^ 1`, so that no input bit is lost when one
+// of the halves is zero. This is the accumulation step of XXH3, which vectorizes with 32-bit
+// multiplies on every instruction set.
+
+void accumulate_portable(uint64_t* lanes, void const* p, std::size_t count) {
+  auto s = static_cast<std::byte const*>(p);
+  for (std::size_t j = 0; j < count; ++j, s += Kernels::stripe_size) {
+    for (std::size_t i = 0; i < 4; ++i) {
+      auto d = load_word(s + 8 * i);
+      auto k = d ^ Hasher::secret[i];
+      lanes[i] += (k & 0xffffffff) * (k >> 32);
+      lanes[i ^ 1] += d;
+    }
+  }
+}
+
+/// The kernels implemented with portable code.
+constexpr Kernels portable_kernels{
+  Kernels::portable, fill_portable, equal_portable, accumulate_portable
+};
+
+// --- x86-64 kernels -----------------------------------------------------------------------------
+
+#if defined(XST_X86_KERNELS)
+
+void fill_sse2(void* target, void const* value, std::size_t width, std::size_t count) {
+  alignas(16) std::byte pattern[pattern_size];
+  if ((width == 1) || !make_pattern(pattern, value, width)) {
+    return fill_portable(target, value, width, count);
+  }
+
+  auto t = static_cast<std::byte*>(target);
+  auto n = width * count;
+  auto v = _mm_load_si128(reinterpret_cast<__m128i const*>(pattern));
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) { _mm_storeu_si128(reinterpret_cast<__m128i*>(t + i), v); }
+  std::memcpy(t + i, pattern, n - i);
+}
+
+bool equal_sse2(void const* a, void const* b, std::size_t n) {
+  auto x = static_cast<std::byte const*>(a);
+  auto y = static_cast<std::byte const*>(b);
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    auto u = _mm_loadu_si128(reinterpret_cast<__m128i const*>(x + i));
+    auto v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(y + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(u, v)) != 0xffff) { return false; }
+  }
+  return equal_portable(x + i, y + i, n - i);
+}
+
+void accumulate_sse2(uint64_t* lanes, void const* p, std::size_t count) {
+  auto s = static_cast<std::byte const*>(p);
+  auto k0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(Hasher::secret));
+  auto k1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(Hasher::secret + 2));
+  auto a0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(lanes));
+  auto a1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(lanes + 2));
+
+  for (std::size_t j = 0; j < count; ++j, s += Kernels::stripe_size) {
+    auto d0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s));
+    auto d1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + 16));
+    auto x0 = _mm_xor_si128(d0, k0);
+    auto x1 = _mm_xor_si128(d1, k1);
+    auto p0 = _mm_mul_epu32(x0, _mm_srli_epi64(x0, 32));
+    auto p1 = _mm_mul_epu32(x1, _mm_srli_epi64(x1, 32));
+    a0 = _mm_add_epi64(a0, _mm_add_epi64(p0, _mm_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+    a1 = _mm_add_epi64(a1, _mm_add_epi64(p1, _mm_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+  }
+
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), a0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 2), a1);
+}
+
+/// The kernels implemented with SSE2.
+constexpr Kernels sse2_kernels{Kernels::sse2, fill_sse2, equal_sse2, accumulate_sse2};
+
+__attribute__((target("avx2")))
+void fill_avx2(void* target, void const* value, std::size_t width, std::size_t count) {
+  alignas(32) std::byte pattern[pattern_size];
+  if ((width == 1) || !make_pattern(pattern, value, width)) {
+    return fill_portable(target, value, width, count);
+  }
+
+  auto t = static_cast<std::byte*>(target);
+  auto n = width * count;
+  auto v = _mm256_load_si256(reinterpret_cast<__m256i const*>(pattern));
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(t + i), v); }
+  std::memcpy(t + i, pattern, n - i);
+}
+
+__attribute__((target("avx2")))
+bool equal_avx2(void const* a, void const* b, std::size_t n) {
+  auto x = static_cast<std::byte const*>(a);
+  auto y = static_cast<std::byte const*>(b);
+  std::size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    auto u = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(x + i));
+    auto v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(y + i));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(u, v)) != -1) { return false; }
+  }
+  return equal_sse2(x + i, y + i, n - i);
+}
+
+/// Mixes one stripe at `s` into `a`, using the keys `k`.
+__attribute__((target("avx2")))
+inline __m256i accumulate_stripe_avx2(__m256i a, std::byte const* s, __m256i k) {
+  auto d = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(s));
+  auto x = _mm256_xor_si256(d, k);
+  auto p = _mm256_mul_epu32(x, _mm256_srli_epi64(x, 32));
+  return _mm256_add_epi64(a, _mm256_add_epi64(p, _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+}
+
+__attribute__((target("avx2")))
+void accumulate_avx2(uint64_t* lanes, void const* p, std::size_t count) {
+  auto s = static_cast<std::byte const*>(p);
+  auto k = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(Hasher::secret));
+  auto a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(lanes));
+  for (std::size_t j = 0; j < count; ++j, s += Kernels::stripe_size) {
+    a = accumulate_stripe_avx2(a, s, k);
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), a);
+}
+
+/// The kernels implemented with AVX2.
+constexpr Kernels avx2_kernels{Kernels::avx2, fill_avx2, equal_avx2, accumulate_avx2};
+
+// GCC reports the placeholders used by some AVX-512 intrinsics as uninitialized.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f,avx512bw")))
+void fill_avx512(void* target, void const* value, std::size_t width, std::size_t count) {
+  alignas(64) std::byte pattern[pattern_size];
+  if ((width == 1) || !make_pattern(pattern, value, width)) {
+    return fill_portable(target, value, width, count);
+  }
+
+  auto t = static_cast<std::byte*>(target);
+  auto n = width * count;
+  auto v = _mm512_load_si512(pattern);
+  std::size_t i = 0;
+  for (; i + 64 <= n; i += 64) { _mm512_storeu_si512(t + i, v); }
+  std::memcpy(t + i, pattern, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+bool equal_avx512(void const* a, void const* b, std::size_t n) {
+  auto x = static_cast<std::byte const*>(a);
+  auto y = static_cast<std::byte const*>(b);
+  std::size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    auto u = _mm512_loadu_si512(x + i);
+    auto v = _mm512_loadu_si512(y + i);
+    if (_mm512_cmpneq_epi64_mask(u, v) != 0) { return false; }
+  }
+  return equal_avx2(x + i, y + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void accumulate_avx512(uint64_t* lanes, void const* p, std::size_t count) {
+  auto s = static_cast<std::byte const*>(p);
+  auto k = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(Hasher::secret));
+  auto kk = _mm512_broadcast_i64x4(k);
+
+  // Two stripes are processed at once, the second one in the upper half of the accumulator.
+  auto a = _mm512_setzero_si512();
+  std::size_t j = 0;
+  for (; j + 2 <= count; j += 2, s += 2 * Kernels::stripe_size) {
+    auto d = _mm512_loadu_si512(s);
+    auto x = _mm512_xor_si512(d, kk);
+    auto p = _mm512_mul_epu32(x, _mm512_srli_epi64(x, 32));
+    a = _mm512_add_epi64(a, _mm512_add_epi64(p, _mm512_shuffle_epi32(d, _MM_PERM_BADC)));
+  }
+
+  auto b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(lanes));
+  b = _mm256_add_epi64(b, _mm512_extracti64x4_epi64(a, 0));
+  b = _mm256_add_epi64(b, _mm512_extracti64x4_epi64(a, 1));
+  if (j < count) { b = accumulate_stripe_avx2(b, s, k); }
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), b);
+}
+
+/// The kernels implemented with AVX-512.
+constexpr Kernels avx512_kernels{
+  Kernels::avx512, fill_avx512, equal_avx512, accumulate_avx512
+};
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+// --- AArch64 kernels ----------------------------------------------------------------------------
+
+#if defined(XST_NEON_KERNELS)
+
+void fill_neon(void* target, void const* value, std::size_t width, std::size_t count) {
+  alignas(16) std::byte pattern[pattern_size];
+  if ((width == 1) || !make_pattern(pattern, value, width)) {
+    return fill_portable(target, value, width, count);
+  }
+
+  auto t = reinterpret_cast<uint8_t*>(target);
+  auto n = width * count;
+  auto v = vld1q_u8(reinterpret_cast<uint8_t const*>(pattern));
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) { vst1q_u8(t + i, v); }
+  std::memcpy(t + i, pattern, n - i);
+}
+
+bool equal_neon(void const* a, void const* b, std::size_t n) {
+  auto x = static_cast<uint8_t const*>(a);
+  auto y = static_cast<uint8_t const*>(b);
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    if (vminvq_u8(vceqq_u8(vld1q_u8(x + i), vld1q_u8(y + i))) != 0xff) { return false; }
+  }
+  return equal_portable(x + i, y + i, n - i);
+}
+
+void accumulate_neon(uint64_t* lanes, void const* p, std::size_t count) {
+  auto s = static_cast<uint8_t const*>(p);
+  auto k0 = vld1q_u64(Hasher::secret);
+  auto k1 = vld1q_u64(Hasher::secret + 2);
+  auto a0 = vld1q_u64(lanes);
+  auto a1 = vld1q_u64(lanes + 2);
+
+  for (std::size_t j = 0; j < count; ++j, s += Kernels::stripe_size) {
+    auto d0 = vreinterpretq_u64_u8(vld1q_u8(s));
+    auto d1 = vreinterpretq_u64_u8(vld1q_u8(s + 16));
+    auto x0 = veorq_u64(d0, k0);
+    auto x1 = veorq_u64(d1, k1);
+    auto p0 = vmull_u32(vmovn_u64(x0), vshrn_n_u64(x0, 32));
+    auto p1 = vmull_u32(vmovn_u64(x1), vshrn_n_u64(x1, 32));
+    a0 = vaddq_u64(a0, vaddq_u64(p0, vextq_u64(d0, d0, 1)));
+    a1 = vaddq_u64(a1, vaddq_u64(p1, vextq_u64(d1, d1, 1)));
+  }
+
+  vst1q_u64(lanes, a0);
+  vst1q_u64(lanes + 2, a1);
+}
+
+/// The kernels implemented with NEON.
+constexpr Kernels neon_kernels{Kernels::neon, fill_neon, equal_neon, accumulate_neon};
+
+#endif
+
+// --- Dispatch -----------------------------------------------------------------------------------
+
+uint64_t Kernels::hash(void const* p, std::size_t n, uint64_t seed) const {
+  uint64_t lanes[4] = {Hasher::secret[0], Hasher::secret[1], Hasher::secret[2], Hasher::secret[3]};
+  auto m = n / stripe_size;
+  accumulate(lanes, p, m);
+
+  Hasher h;
+  h.combine_word(seed);
+  h.combine_word(n);
+  for (auto l : lanes) { h.combine_word(l); }
+
+  // The bytes that don't fill a stripe are mixed one word at a time, zero-padded.
+  auto s = static_cast<std::byte const*>(p);
+  for (auto i = m * stripe_size; i < n; i += sizeof(uint64_t)) {
+    uint64_t w = 0;
+    std::memcpy(&w, s + i, std::min(sizeof(uint64_t), n - i));
+    h.combine_word(w);
+  }
+  return h.finalize();
+}
+
+Kernels const* Kernels::with(InstructionSet s) {
+  switch (s) {
+    case portable:
+      return &portable_kernels;
+
+#if defined(XST_X86_KERNELS)
+    case sse2:
+      return &sse2_kernels;
+    case avx2:
+      return __builtin_cpu_supports("avx2") ? &avx2_kernels : nullptr;
+    case avx512:
+      return (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        ? &avx512_kernels : nullptr;
+#endif
+
+#if defined(XST_NEON_KERNELS)
+    case neon:
+      return &neon_kernels;
+#endif
+
+    default:
+      return nullptr;
+  }
+}
+
+Kernels const& Kernels::native() {
+  static Kernels const* k = [] {
+    for (auto s : {avx512, avx2, sse2, neon}) {
+      if (auto r = with(s)) { return r; }
+    }
+    return &portable_kernels;
+  }();
+  return *k;
+}
+
+// --- Typed bulk operations ----------------------------------------------------------------------
+
+void fill_n(BuiltinHeader::Value type, void* target, void const* value, std::size_t count) {
+  Kernels::native().fill(target, value, BuiltinHeader{type}.size(), count);
+}
+
+void copy_n(BuiltinHeader::Value type, void* target, void const* source, std::size_t count) {
+  // The C library already selects a vectorized implementation of `memcpy` at load time.
+  auto n = BuiltinHeader{type}.size() * count;
+  if (n != 0) { std::memcpy(target, source, n); }
+}
+
+bool equal_n(BuiltinHeader::Value type, void const* a, void const* b, std::size_t count) {
+  return Kernels::native().equal(a, b, BuiltinHeader{type}.size() * count);
+}
+
+uint64_t hash_n(BuiltinHeader::Value type, void const* p, std::size_t count) {
+  return Kernels::native().hash(p, BuiltinHeader{type}.size() * count);
+}
+
+bool equal_n(WitnessTable const& witnesses, void const* a, void const* b, std::size_t count) {
+  auto const& k = Kernels::native();
+  auto s = witnesses.size;
+  auto d = witnesses.stride();
+  if (s == d) { return k.equal(a, b, s * count); }
+
+  // Padding between instances must be skipped.
+  auto x = static_cast<std::byte const*>(a);
+  auto y = static_cast<std::byte const*>(b);
+  for (std::size_t i = 0; i < count; ++i) {
+    if (!k.equal(x + i * d, y + i * d, s)) { return false; }
+  }
+  return true;
+}
+
+uint64_t hash_n(WitnessTable const& witnesses, void const* p, std::size_t count) {
+  auto const& k = Kernels::native();
+  auto s = witnesses.size;
+  auto d = witnesses.stride();
+  if (s == d) { return k.hash(p, s * count); }
+
+  // Padding between instances must be skipped.
+  auto x = static_cast<std::byte const*>(p);
+  Hasher h;
+  for (std::size_t i = 0; i < count; ++i) { h.combine_word(k.hash(x + i * d, s)); }
+  return h.finalize();
+}
+
+}
@@ -0,0 +1,74 @@
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#endif
+
+namespace xst {
+
+#if defined(__unix__) || defined(__APPLE__)
+
+/// Throws an exception describing the last error of a system call on the file at `path`.
+[[noreturn]] void throw_system_error(char const* path) {
+  throw std::system_error(errno, std::generic_category(), path);
+}
+
+MappedFile::MappedFile(char const* path) {
+  auto d = ::open(path, O_RDONLY);
+  if (d < 0) { throw_system_error(path); }
+
+  struct stat s;
+  if (::fstat(d, &s) != 0) {
+    ::close(d);
+    throw_system_error(path);
+  }
+
+  size = static_cast<std::size_t>(s.st_size);
+  if (size > 0) {
+    auto p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, d, 0);
+    if (p == MAP_FAILED) {
+      ::close(d);
+      throw_system_error(path);
+    }
+    base = static_cast<std::byte const*>(p);
+  }
+  ::close(d);
+}
+
+MappedFile::~MappedFile() {
+  if (base != nullptr) { ::munmap(const_cast<std::byte*>(base), size); }
+}
+
+#else
+
+MappedFile::MappedFile(char const* path) {
+  std::ifstream f{path, std::ios::binary};
+  if (!f) { throw std::system_error(ENOENT, std::generic_category(), path); }
+  std::string contents{std::istreambuf_iterator<char>{f}, std::istreambuf_iterator<char>{}};
+
+  size = contents.size();
+  if (size > 0) {
+    auto p = new std::byte[size];
+    std::memcpy(p, contents.data(), size);
+    base = p;
+  }
+}
+
+MappedFile::~MappedFile() {
+  delete[] base;
+}
+
+#endif
+
+}
@@ -0,0 +1,29 @@
+#include "ScratchArena.h"
+
+namespace xst {
+
+ScratchArena::~ScratchArena() {
+  for (auto b : blocks) {
+    ::operator delete(b, std::align_val_t{alignof(std::max_align_t)});
+  }
+}
+
+void* ScratchArena::allocate_slow(std::size_t s, std::size_t a) {
+  // Blocks that have been released are reused before new ones are allocated.
+  auto n = (cursor == nullptr) ? current : current + 1;
+  if (n == blocks.size()) {
+    blocks.push_back(static_cast<std::byte*>(
+      ::operator new(block_size, std::align_val_t{alignof(std::max_align_t)})));
+  }
+
+  current = n;
+  cursor = blocks[n];
+  limit = cursor + block_size;
+
+  auto p = reinterpret_cast<uintptr_t>(cursor);
+  auto q = (p + (a - 1)) & ~(static_cast<uintptr_t>(a) - 1);
+  cursor = reinterpret_cast<std::byte*>(q + s);
+  return reinterpret_cast<void*>(q);
+}
+
+}
@@ -0,0 +1,340 @@
+#include "Serialization.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace xst {
+
+static_assert(sizeof(std::ptrdiff_t) == sizeof(void*));
+
+/// Returns the relative offset stored at `p`.
+inline std::ptrdiff_t load_offset(std::byte const* p) {
+  std::ptrdiff_t result;
+  std::memcpy(&result, p, sizeof(std::ptrdiff_t));
+  return result;
+}
+
+/// Stores `value` at `p`.
+inline void store_offset(std::byte* p, std::ptrdiff_t value) {
+  std::memcpy(p, &value, sizeof(std::ptrdiff_t));
+}
+
+/// An out-of-line part that has been written to an image but whose own parts must still be.
+struct PendingWrite {
+
+  /// The table describing the part.
+  WitnessTable const* witnesses;
+
+  /// The position of the part in the image.
+  std::size_t position;
+
+  /// The address of the part in the original instance.
+  std::byte const* source;
+
+};
+
+/// The state of the serialization of an instance.
+struct Writer {
+
+  /// The image being written.
+  std::vector<std::byte> image;
+
+  /// The position of each shared box that has been written, keyed by its payload.
+  std::unordered_map<void const*, std::size_t> shared;
+
+  /// The out-of-line parts that remain to be written.
+  std::vector<PendingWrite> pending;
+
+  /// Appends a copy of the inline representation of the instance described by `w` at `source`
+  /// and returns its position.
+  std::size_t append(WitnessTable const& w, std::byte const* source) {
+    auto a = w.alignment;
+    auto position = (image.size() + a - 1) & ~(a - 1);
+    image.resize(position + w.size);
+    if (w.size > 0) { std::memcpy(image.data() + position, source, w.size); }
+    if (!w.operations.empty()) { pending.push_back({&w, position, source}); }
+    return position;
+  }
+
+  /// Applies `operations` to replace the pointers to out-of-line parts in the copy at `position`
+  /// of the instance at `source` by relative offsets, appending those parts to the image.
+  ///
+  /// Only the nesting of inline sums, which is bounded by the type of the value, causes recursion.
+  void write_parts(
+    std::span<WitnessTable::Operation const> operations,
+    std::size_t position, std::byte const* source
+  ) {
+    for (auto const& o : operations) {
+      auto const& w = *o.witnesses;
+      switch (o.kind) {
+        case WitnessTable::Operation::box:
+        case WitnessTable::Operation::shared_box: {
+          // Null pointers have been copied with the inline representation.
+          auto s = static_cast<std::byte const*>(load_pointer(source + o.offset));
+          if (s == nullptr) { break; }
+
+          // Parts without size are appended without growing the image, so they aren't shared.
+          std::size_t p;
+          if ((o.kind == WitnessTable::Operation::box) || (w.size == 0)) {
+            p = append(w, s);
+          } else if (auto i = shared.find(s); i != shared.end()) {
+            p = i->second;
+          } else {
+            p = append(w, s);
+            shared.emplace(s, p);
+          }
+
+          auto slot = position + o.offset;
+          store_offset(image.data() + slot, static_cast<std::ptrdiff_t>(p - slot));
+          break;
+        }
+
+        case WitnessTable::Operation::sum: {
+          auto s = source + o.offset;
+          write_parts(w.cases[w.case_of(s)], position + o.offset, s);
+          break;
+        }
+      }
+    }
+  }
+
+};
+
+/// An out-of-line part of an image that must be checked.
+struct PendingCheck {
+
+  /// The table describing the part.
+  WitnessTable const* witnesses;
+
+  /// The position of the part in the image.
+  std::size_t position;
+
+};
+
+/// A part of an image that has been reached by a check.
+struct VisitedPart {
+
+  /// The table describing the part.
+  WitnessTable const* witnesses;
+
+  /// `true` iff the part has been reached through a shared box.
+  bool is_shared;
+
+};
+
+/// Applies `operations` to check the relative offsets in the part at `position` in `image`,
+/// adding the parts to which they refer to `pending` and to `visited`, keyed by position.
+///
+/// Relative offsets are positive, so that the position of the parts added to `pending` is greater
+/// than `position` and the check terminates. A position holds a single part with a size, reached
+/// either through one box or through shared boxes of the same type. Hence, every byte of an
+/// accepted image is read as an instance of the type with which it has been checked, and the cost
+/// of the check is linear in the size of the image.
+void check_parts(
+  std::span<WitnessTable::Operation const> operations,
+  std::span<std::byte const> image, std::size_t position,
+  std::unordered_map<std::size_t, VisitedPart>& visited, std::vector<PendingCheck>& pending
+) {
+  for (auto const& o : operations) {
+    auto const& w = *o.witnesses;
+    auto slot = position + o.offset;
+    switch (o.kind) {
+      case WitnessTable::Operation::box:
+      case WitnessTable::Operation::shared_box: {
+        auto r = load_offset(image.data() + slot);
+        if (r == 0) { break; }
+        if ((r < 0) || (static_cast<std::size_t>(r) > image.size() - slot)) {
+          throw std::invalid_argument("relative offset out of bounds");
+        }
+
+        auto p = slot + static_cast<std::size_t>(r);
+        if ((w.size > image.size() - p) || ((p & (w.alignment - 1)) != 0)) {
+          throw std::invalid_argument("misplaced out-of-line part");
+        }
+        // Parts without size have nothing to check and may share their position with others.
+        if (w.size == 0) { break; }
+
+        auto is_shared = o.kind == WitnessTable::Operation::shared_box;
+        auto [i, inserted] = visited.try_emplace(p, VisitedPart{&w, is_shared});
+        if (!inserted) {
+          if (!is_shared || !i->second.is_shared || (i->second.witnesses != &w)) {
+            throw std::invalid_argument("aliased out-of-line part");
+          }
+          break;
+        }
+        if (!w.operations.empty()) { pending.push_back({&w, p}); }
+        break;
+      }
+
+      case WitnessTable::Operation::sum: {
+        auto c = w.case_of(image.data() + slot);
+        if (c >= w.cases.size()) { throw std::invalid_argument("invalid case"); }
+        check_parts(w.cases[c], image, slot, visited, pending);
+        break;
+      }
+    }
+  }
+}
+
+/// Throws an exception if `image` isn't the image of an instance described by `witnesses`.
+void check(WitnessTable const& witnesses, std::span<std::byte const> image) {
+  if (image.size() < witnesses.size) { throw std::invalid_argument("truncated image"); }
+
+  std::unordered_map<std::size_t, VisitedPart> visited;
+  std::vector<PendingCheck> pending;
+  check_parts(witnesses.operations, image, 0, visited, pending);
+  while (!pending.empty()) {
+    auto p = pending.back();
+    pending.pop_back();
+    check_parts(p.witnesses->operations, image, p.position, visited, pending);
+  }
+}
+
+/// An out-of-line part that has been copied from an image but whose own parts must still be.
+struct PendingRead {
+
+  /// The table describing the part.
+  WitnessTable const* witnesses;
+
+  /// The position of the part in the image.
+  std::size_t position;
+
+  /// The address of the copy.
+  std::byte* target;
+
+};
+
+/// The state of the deserialization of an instance.
+struct Reader {
+
+  /// The image being read.
+  std::span<std::byte const> image;
+
+  /// The allocator of the out-of-line storage of the instance.
+  Allocator& allocator;
+
+  /// The payload of each shared box with a size that has been read, keyed by its position in the
+  /// image, which `check` guarantees to hold a single part.
+  std::unordered_map<std::size_t, void*> shared;
+
+  /// The out-of-line parts that remain to be read.
+  std::vector<PendingRead> pending;
+
+  /// Returns the address of a new box containing a copy of the part at `position` in the image,
+  /// described by `w`.
+  void* materialize(WitnessTable const& w, std::size_t position, bool is_shared) {
+    void* t;
+    if (is_shared) {
+      t = allocate_shared_box(w, allocator);
+    } else if (w.size == 0) {
+      t = empty_box();
+    } else {
+      t = allocator.allocate(w.size, w.alignment);
+    }
+
+    if (w.size > 0) { std::memcpy(t, image.data() + position, w.size); }
+    if (!w.operations.empty()) {
+      pending.push_back({&w, position, static_cast<std::byte*>(t)});
+    }
+    return t;
+  }
+
+  /// Applies `operations` to replace the relative offsets in the copy at `target` of the part at
+  /// `position` in the image by pointers to new boxes.
+  ///
+  /// Only the nesting of inline sums, which is bounded by the type of the value, causes recursion.
+  void read_parts(
+    std::span<WitnessTable::Operation const> operations,
+    std::size_t position, std::byte* target
+  ) {
+    for (auto const& o : operations) {
+      auto const& w = *o.witnesses;
+      auto slot = position + o.offset;
+      switch (o.kind) {
+        case WitnessTable::Operation::box:
+        case WitnessTable::Operation::shared_box: {
+          auto r = load_offset(image.data() + slot);
+          if (r == 0) {
+            store_pointer(target + o.offset, nullptr);
+            break;
+          }
+
+          auto p = slot + static_cast<std::size_t>(r);
+          void* t;
+          if ((o.kind == WitnessTable::Operation::box) || (w.size == 0)) {
+            t = materialize(w, p, o.kind == WitnessTable::Operation::shared_box);
+          } else if (auto i = shared.find(p); i != shared.end()) {
+            t = i->second;
+            reference_count(t).fetch_add(1, std::memory_order_relaxed);
+          } else {
+            t = materialize(w, p, true);
+            shared.emplace(p, t);
+          }
+          store_pointer(target + o.offset, t);
+          break;
+        }
+
+        case WitnessTable::Operation::sum: {
+          auto t = target + o.offset;
+          read_parts(w.cases[w.case_of(t)], slot, t);
+          break;
+        }
+      }
+    }
+  }
+
+};
+
+std::vector<std::byte> serialize(TypeStore const& store, TypeHeader const* type, void* source) {
+  auto const& w = store.witnesses(type);
+  auto s = static_cast<std::byte const*>(source);
+
+  Writer writer;
+  writer.image.resize(w.size);
+  if (w.size > 0) { std::memcpy(writer.image.data(), s, w.size); }
+  writer.write_parts(w.operations, 0, s);
+  while (!writer.pending.empty()) {
+    auto p = writer.pending.back();
+    writer.pending.pop_back();
+    writer.write_parts(p.witnesses->operations, p.position, p.source);
+  }
+  return std::move(writer.image);
+}
+
+void deserialize(
+  TypeStore const& store, TypeHeader const* type, void* target, std::span<std::byte const> image
+) {
+  auto const& w = store.witnesses(type);
+  check(w, image);
+
+  auto t = static_cast<std::byte*>(target);
+  Reader reader{image, store.value_allocator(), {}, {}};
+  if (w.size > 0) { std::memcpy(t, image.data(), w.size); }
+  reader.read_parts(w.operations, 0, t);
+  while (!reader.pending.empty()) {
+    auto p = reader.pending.back();
+    reader.pending.pop_back();
+    reader.read_parts(p.witnesses->operations, p.position, p.target);
+  }
+}
+
+SerializedValue::SerializedValue(
+  TypeStore const& store, TypeHeader const* type, std::span<std::byte const> image
+) : store(store), root_type(type), image(image) {
+  if ((reinterpret_cast<uintptr_t>(image.data()) & (alignof(std::max_align_t) - 1)) != 0) {
+    throw std::invalid_argument("misaligned image");
+  }
+  check(store.witnesses(type), image);
+}
+
+void const* SerializedValue::address_of(
+  Metatype const& m, std::size_t i, void const* base
+) const {
+  auto field_address = static_cast<std::byte const*>(base) + store.offset(m, i);
+  if (!m.fields()[i].out_of_line()) { return field_address; }
+  auto r = load_offset(field_address);
+  return (r == 0) ? nullptr : field_address + r;
+}
+
+}
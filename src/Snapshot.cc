@@ -0,0 +1,449 @@
+#include "TypeStore.h"
+
+#include <string>
+#include <system_error>
+#include <unordered_map>
+
+namespace xst {
+
+// A snapshot is a sequence of 64-bit words followed by a table of strings. The words start with
+// a header describing the snapshot and the offset of each entry, in words. An entry describes
+// the header of a type (its kind, hash, description, and either its built-in value or its name
+// and arguments) and, if the type is defined, its metatype and witness operations. Types are
+// referred to by their position in the snapshot and strings by their offset in the string table.
+
+/// The first word of a snapshot, which also identifies the byte order of the writer.
+constexpr uint64_t snapshot_magic = 0x3170616e73747378; // "xstsnap1"
+
+/// The version of the format of a snapshot.
+constexpr uint64_t snapshot_version = 2;
+
+/// The number of words in the header of a snapshot, which are the magic number, the version,
+/// the size of a pointer, the number of entries, and the offset and size of the string table,
+/// in bytes.
+constexpr std::size_t snapshot_header_words = 6;
+
+/// The number of words taken by a tag encoding in a snapshot.
+constexpr std::size_t snapshot_tag_words =
+  (sizeof(TagEncoding) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+/// A witness operation recorded in a snapshot.
+struct SnapshotOperation {
+
+  /// The kind of the operation.
+  WitnessTable::Operation::Kind kind;
+
+  /// The offset of the part on which the operation applies.
+  std::size_t offset;
+
+  /// The position of the type whose table describes the part.
+  std::size_t type;
+
+};
+
+/// A type recorded in a snapshot.
+struct SnapshotRecord {
+
+  /// The kind of the type.
+  TypeHeader::Kind kind;
+
+  /// The raw value of the type, if it is built-in.
+  BuiltinHeader::Value raw_value = BuiltinHeader::boolean;
+
+  /// The hash of the header of the type.
+  std::size_t hash;
+
+  /// The description of the type.
+  std::string_view description;
+
+  /// The name of the type, unless it is built-in.
+  std::string_view name;
+
+  /// The positions of the arguments of the type, unless it is built-in.
+  std::vector<std::size_t> arguments;
+
+  /// `true` iff the type is defined.
+  bool defined = false;
+
+  /// The size of an instance, if the type is defined.
+  std::size_t size = 0;
+
+  /// The alignment of an instance, if the type is defined.
+  std::size_t alignment = 1;
+
+  /// `true` iff the type is trivial, if it is defined.
+  bool trivial = false;
+
+  /// `true` iff instances can be compared bitwise, if the type is defined.
+  bool bitwise_equatable = false;
+
+  /// The encoding of the case of an instance, if the type is a defined sum.
+  TagEncoding tag;
+
+  /// The fields of the type, as the positions of their types shifted left by two bits and
+  /// combined with their flags, if the type is defined.
+  std::vector<uint64_t> fields;
+
+  /// The offsets of the fields, if the type is defined.
+  std::vector<std::size_t> offsets;
+
+  /// The operations on the payload of each case if the type is a sum, or a single list of
+  /// operations otherwise, if the type is defined.
+  std::vector<std::vector<SnapshotOperation>> operations;
+
+};
+
+/// A reader of the words of a snapshot that throws if it reads past their end.
+struct SnapshotCursor {
+
+  /// The contents of the snapshot.
+  std::span<std::byte const> contents;
+
+  /// The number of words in the snapshot.
+  std::size_t limit;
+
+  /// The position of the next word to read.
+  std::size_t position = 0;
+
+  /// Returns the next word and advances the position of `this`.
+  uint64_t next() {
+    if (position >= limit) { throw std::invalid_argument("truncated snapshot"); }
+    uint64_t w;
+    std::memcpy(&w, contents.data() + position * sizeof(uint64_t), sizeof(uint64_t));
+    ++position;
+    return w;
+  }
+
+  /// Returns the next word, which must be less than `bound`, and advances the position of `this`.
+  uint64_t next(uint64_t bound) {
+    auto w = next();
+    if (w >= bound) { throw std::invalid_argument("value out of bounds in snapshot"); }
+    return w;
+  }
+
+};
+
+/// Throws if the fields or operations of `r`, which is defined, refer to parts that don't fit in
+/// its instances or to types that aren't defined, given the other types in `records`.
+void check_layout(SnapshotRecord const& r, std::vector<SnapshotRecord> const& records) {
+  auto fits = [&](std::size_t offset, std::size_t size) {
+    if ((offset > r.size) || (size > r.size - offset)) {
+      throw std::invalid_argument("bad layout in snapshot");
+    }
+  };
+
+  for (std::size_t j = 0; j < r.fields.size(); ++j) {
+    auto const& t = records[r.fields[j] >> 2];
+    if (r.fields[j] & 0b11) {
+      fits(r.offsets[j], sizeof(void*));
+    } else if (t.defined) {
+      fits(r.offsets[j], t.size);
+    } else {
+      throw std::invalid_argument("undefined field type in snapshot");
+    }
+  }
+
+  for (auto const& os : r.operations) {
+    for (auto const& o : os) {
+      auto const& t = records[o.type];
+      if (!t.defined) { throw std::invalid_argument("undefined operation type in snapshot"); }
+      if (o.kind == WitnessTable::Operation::sum) {
+        if (t.kind != TypeHeader::sum) { throw std::invalid_argument("bad operation in snapshot"); }
+        fits(o.offset, t.size);
+      } else {
+        fits(o.offset, sizeof(void*));
+      }
+    }
+  }
+}
+
+/// Returns the types recorded in `snapshot`, or throws if it is malformed.
+std::vector<SnapshotRecord> decode(std::span<std::byte const> snapshot) {
+  SnapshotCursor c{snapshot, snapshot.size() / sizeof(uint64_t)};
+  if (c.next() != snapshot_magic) { throw std::invalid_argument("not a snapshot"); }
+  if (c.next() != snapshot_version) { throw std::invalid_argument("unsupported snapshot"); }
+  if (c.next() != sizeof(void*)) { throw std::invalid_argument("incompatible snapshot"); }
+
+  auto n = c.next(c.limit);
+  auto string_offset = c.next(snapshot.size() + 1);
+  auto string_size = c.next(snapshot.size() - string_offset + 1);
+  c.limit = std::min(c.limit, string_offset / sizeof(uint64_t));
+  std::string_view strings{
+    reinterpret_cast<char const*>(snapshot.data()) + string_offset, string_size};
+
+  auto string = [&]() {
+    auto o = c.next(string_size + 1);
+    auto s = c.next(string_size - o + 1);
+    return strings.substr(o, s);
+  };
+
+  std::vector<SnapshotRecord> result(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    auto& r = result[i];
+    c.position = snapshot_header_words + i;
+    c.position = c.next(c.limit);
+
+    auto flags = c.next();
+    r.kind = static_cast<TypeHeader::Kind>(flags & 0xff);
+    r.defined = (flags >> 8) & 1;
+    r.hash = c.next();
+    r.description = string();
+
+    switch (r.kind) {
+      case TypeHeader::builtin:
+        if ((flags >> 16) > BuiltinHeader::fun) { throw std::invalid_argument("bad built-in"); }
+        r.raw_value = static_cast<BuiltinHeader::Value>(flags >> 16);
+#ifndef NDEBUG
+        if (r.hash != BuiltinHeader::hash_of(r.raw_value)) {
+          throw std::invalid_argument("bad hash in snapshot");
+        }
+#endif
+        break;
+
+      case TypeHeader::product:
+      case TypeHeader::sum: {
+        r.name = string();
+        if (r.name.find('\0') != std::string_view::npos) {
+          throw std::invalid_argument("bad name in snapshot");
+        }
+        auto m = c.next(c.limit);
+        for (std::size_t j = 0; j < m; ++j) { r.arguments.push_back(c.next(i)); }
+
+#ifndef NDEBUG
+        // A wrong hash would intern the header in the wrong shard.
+        std::vector<std::size_t> hashes;
+        for (auto a : r.arguments) { hashes.push_back(result[a].hash); }
+        if (r.hash != CompositeHeader::hash_of(r.kind, r.name, hashes)) {
+          throw std::invalid_argument("bad hash in snapshot");
+        }
+#endif
+        break;
+      }
+
+      default:
+        throw std::invalid_argument("bad kind in snapshot");
+    }
+    if (!r.defined) { continue; }
+
+    r.size = c.next();
+    r.alignment = c.next();
+    if (!std::has_single_bit(r.alignment)) { throw std::invalid_argument("bad alignment"); }
+    auto properties = c.next();
+    r.trivial = properties & 1;
+    r.bitwise_equatable = (properties >> 1) & 1;
+
+    uint64_t tag[snapshot_tag_words];
+    for (auto& w : tag) { w = c.next(); }
+    std::memcpy(static_cast<void*>(&r.tag), tag, sizeof(TagEncoding));
+    // Niches in out-of-line fields are as wide as a pointer.
+    auto width_ok = (r.tag.width == 0) || (r.tag.width == 1) || (r.tag.width == 2)
+      || (r.tag.width == 4) || (r.tag.uses_niche() && (r.tag.width == sizeof(void*)));
+    if (!width_ok || (r.tag.uses_niche() && (r.tag.width == 0))) {
+      throw std::invalid_argument("bad tag encoding");
+    }
+    if ((r.tag.width != 0) && (r.size < r.tag.offset + std::size_t{r.tag.width})) {
+      throw std::invalid_argument("bad tag encoding");
+    }
+
+    auto m = c.next(c.limit);
+    for (std::size_t j = 0; j < m; ++j) { r.fields.push_back(c.next(n << 2)); }
+    for (std::size_t j = 0; j < m; ++j) { r.offsets.push_back(c.next(r.size + 1)); }
+
+    if (r.tag.uses_niche() && (r.tag.payload_case >= m)) {
+      throw std::invalid_argument("bad tag encoding");
+    }
+
+    // The operations of a sum are recorded for each of its cases, unless it is trivial.
+    std::size_t lists = 1;
+    if (r.kind == TypeHeader::sum) {
+      lists = c.next();
+      if (lists != (r.trivial ? 0 : m)) {
+        throw std::invalid_argument("bad operations in snapshot");
+      }
+    }
+    for (std::size_t j = 0; j < lists; ++j) {
+      auto& operations = r.operations.emplace_back();
+      auto k = c.next(c.limit);
+      for (std::size_t l = 0; l < k; ++l) {
+        auto kind = static_cast<WitnessTable::Operation::Kind>(
+          c.next(WitnessTable::Operation::shared_box + 1));
+        auto offset = c.next(r.size + 1);
+        operations.push_back({kind, offset, c.next(n)});
+      }
+    }
+  }
+
+  for (auto const& r : result) {
+    if (r.defined) { check_layout(r, result); }
+  }
+  return result;
+}
+
+std::vector<std::byte> TypeStore::snapshot() const {
+  // Assign positions to the types whose header has been published.
+  std::vector<Entry const*> entries;
+  std::unordered_map<TypeHeader const*, uint64_t> positions;
+  std::unordered_map<WitnessTable const*, uint64_t> tables;
+  auto n = entry_count.load(std::memory_order_acquire);
+  for (std::size_t i = 0; i < n; ++i) {
+    auto e = entry(i);
+    auto h = (e != nullptr) ? e->header.load(std::memory_order_acquire) : nullptr;
+    if (h == nullptr) { continue; }
+    positions.emplace(h, entries.size());
+    tables.emplace(&e->witnesses, entries.size());
+    entries.push_back(e);
+  }
+
+  // Types may be referred to by a header that is equal to their interned one.
+  auto position_of = [&](TypeHeader const* t) -> uint64_t {
+    if (auto p = positions.find(t); p != positions.end()) { return p->second; }
+    auto e = entry_of(t);
+    auto h = (e != nullptr) ? e->header.load(std::memory_order_acquire) : nullptr;
+    if (auto p = positions.find(h); p != positions.end()) { return p->second; }
+    throw std::logic_error(t->description() + " is not declared");
+  };
+
+  std::vector<uint64_t> words(snapshot_header_words + entries.size());
+  std::string strings;
+  auto string = [&](std::string_view s) {
+    words.push_back(strings.size());
+    words.push_back(s.size());
+    strings.append(s);
+  };
+  auto operations = [&](std::span<WitnessTable::Operation const> os) {
+    words.push_back(os.size());
+    for (auto const& o : os) {
+      words.push_back(o.kind);
+      words.push_back(o.offset);
+      words.push_back(tables.at(o.witnesses));
+    }
+  };
+
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    auto const& e = *entries[i];
+    auto h = e.header.load(std::memory_order_relaxed);
+    auto defined = e.is_defined.load(std::memory_order_acquire);
+    words[snapshot_header_words + i] = words.size();
+
+    uint64_t flags = h->kind | (uint64_t{defined} << 8);
+    if (h->kind == TypeHeader::builtin) {
+      flags |= uint64_t{static_cast<BuiltinHeader const*>(h)->raw_value} << 16;
+    }
+    words.push_back(flags);
+    words.push_back(h->hash_value());
+    string(e.description);
+
+    if (h->kind != TypeHeader::builtin) {
+      auto c = static_cast<CompositeHeader const*>(h);
+      string(c->name);
+      words.push_back(c->arguments.size());
+      for (auto a : c->arguments) {
+        auto p = position_of(a);
+        if (p >= i) { throw std::logic_error(h->description() + " can't be recorded"); }
+        words.push_back(p);
+      }
+    }
+    if (!defined) { continue; }
+
+    auto const& m = e.metatype;
+    auto const& w = e.witnesses;
+    words.push_back(m.size());
+    words.push_back(m.alignment());
+    words.push_back(uint64_t{m.is_trivial()} | (uint64_t{w.bitwise_equatable} << 1));
+
+    uint64_t tag[snapshot_tag_words] = {};
+    auto t = m.tag_encoding();
+    std::memcpy(tag, &t, sizeof(TagEncoding));
+    words.insert(words.end(), std::begin(tag), std::end(tag));
+
+    auto fields = m.fields();
+    words.push_back(fields.size());
+    for (auto const& f : fields) {
+      words.push_back((position_of(f.type()) << 2) | (f.raw_value & 0b11));
+    }
+    words.insert(words.end(), m.offsets().begin(), m.offsets().end());
+
+    if (h->kind == TypeHeader::sum) {
+      words.push_back(w.cases.size());
+      for (auto const& c : w.cases) { operations(c); }
+    } else {
+      operations(w.operations);
+    }
+  }
+
+  words[0] = snapshot_magic;
+  words[1] = snapshot_version;
+  words[2] = sizeof(void*);
+  words[3] = entries.size();
+  words[4] = words.size() * sizeof(uint64_t);
+  words[5] = strings.size();
+
+  std::vector<std::byte> result(words.size() * sizeof(uint64_t) + strings.size());
+  std::memcpy(result.data(), words.data(), words.size() * sizeof(uint64_t));
+  std::memcpy(result.data() + words.size() * sizeof(uint64_t), strings.data(), strings.size());
+  return result;
+}
+
+void TypeStore::restore(std::span<std::byte const> snapshot) {
+  if (entry_count.load(std::memory_order_acquire) != 0) {
+    throw std::logic_error("store is not empty");
+  }
+  auto records = decode(snapshot);
+  reserve(records.size());
+
+  // Intern the headers in order, so that the ID of each type is its position in the snapshot.
+  std::vector<TypeHeader const*> headers;
+  for (auto const& r : records) {
+    auto& s = shard(r.hash);
+    std::lock_guard<std::mutex> l{s.mutex};
+
+    TypeHeader* h;
+    if (r.kind == TypeHeader::builtin) {
+      h = s.arena.create<BuiltinHeader>(r.raw_value);
+    } else {
+      auto name = static_cast<char*>(s.arena.allocate(r.name.size() + 1, 1));
+      std::memcpy(name, r.name.data(), r.name.size());
+      name[r.name.size()] = '\0';
+
+      std::vector<TypeHeader const*> a;
+      for (auto p : r.arguments) { a.push_back(headers[p]); }
+      auto arguments = s.arena.copy(std::span<TypeHeader const* const>{a});
+      if (r.kind == TypeHeader::product) {
+        h = s.arena.create<StructHeader>(name, arguments, r.hash);
+      } else {
+        h = s.arena.create<EnumHeader>(name, arguments, r.hash);
+      }
+    }
+
+    intern(s, h, r.hash, Metatype{}, {}, r.description);
+    headers.push_back(h);
+  }
+
+  // Define the types, now that all entries are allocated.
+  for (std::size_t i = 0; i < records.size(); ++i) {
+    auto const& r = records[i];
+    if (!r.defined) { continue; }
+
+    std::vector<Field> fields;
+    for (auto f : r.fields) { fields.emplace_back(headers[f >> 2], f & 0b01, f & 0b10); }
+    auto offsets = r.offsets;
+    Metatype m{r.size, r.alignment, r.trivial, std::move(fields), std::move(offsets), r.tag};
+
+    auto table = [&](std::vector<SnapshotOperation> const& os) {
+      std::vector<WitnessTable::Operation> result;
+      for (auto const& o : os) { result.push_back({o.kind, o.offset, &entry(o.type)->witnesses}); }
+      return result;
+    };
+
+    WitnessOperations w;
+    w.bitwise_equatable = r.bitwise_equatable;
+    if (r.kind == TypeHeader::sum) {
+      for (auto const& os : r.operations) { w.cases.push_back(table(os)); }
+    } else {
+      w.operations = table(r.operations.front());
+    }
+    publish(*entry(i), headers[i], std::move(m), w);
+  }
+}
+
+}
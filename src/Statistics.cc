@@ -0,0 +1,94 @@
+#include "Statistics.h"
+
+#include <bit>
+#include <utility>
+
+namespace xst {
+
+/// The identity of the next instance of `Statistics`.
+static std::atomic<std::uint64_t> next_statistics_identity{1};
+
+char const* Statistics::name(Event e) {
+  switch (e) {
+    case declare_hit: return "declare hits";
+    case declare_miss: return "declare misses";
+    case metatype_lookup: return "lookups";
+    case box_allocation: return "boxes";
+    case allocated_bytes: return "bytes";
+    case copied_node: return "copies";
+    case deallocation: return "frees";
+  }
+  return "";
+}
+
+Statistics::Statistics() : identity(next_statistics_identity.fetch_add(1)) {}
+
+Statistics::~Statistics() = default;
+
+Statistics::Table::~Table() {
+  for (auto& s : segments) {
+    delete[] s.load(std::memory_order_relaxed);
+  }
+}
+
+Statistics::Table& Statistics::local_table() {
+  // Identities are never reused, so the entries of destroyed instances are never matched again.
+  thread_local std::vector<std::pair<std::uint64_t, Table*>> local;
+  if (!local.empty() && (local.back().first == identity)) { return *local.back().second; }
+
+  // Move the entry of this instance last so that it's found immediately next time.
+  for (auto& e : local) {
+    if (e.first == identity) {
+      std::swap(e, local.back());
+      return *local.back().second;
+    }
+  }
+
+  std::lock_guard<std::mutex> l{mutex};
+  tables.push_back(std::make_unique<Table>());
+  local.emplace_back(identity, tables.back().get());
+  return *tables.back();
+}
+
+void Statistics::record(Event e, std::size_t type, std::uint64_t n) {
+  auto j = type + first_segment_size;
+  if (j < type) { return; }
+  auto k = static_cast<std::size_t>(std::bit_width(j) - std::bit_width(first_segment_size));
+  if (k >= segment_count) { return; }
+
+  // Only the calling thread allocates the segments of its table and writes to them.
+  auto& t = local_table();
+  auto s = t.segments[k].load(std::memory_order_relaxed);
+  if (s == nullptr) {
+    s = new Row[first_segment_size << k]{};
+    t.segments[k].store(s, std::memory_order_release);
+  }
+  auto& c = s[j - (first_segment_size << k)][e];
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+std::vector<Statistics::Counts> Statistics::snapshot() const {
+  std::vector<Counts> result;
+  std::lock_guard<std::mutex> l{mutex};
+  for (auto const& t : tables) {
+    for (std::size_t k = 0; k < segment_count; ++k) {
+      auto s = t->segments[k].load(std::memory_order_acquire);
+      if (s == nullptr) { continue; }
+
+      auto first = (first_segment_size << k) - first_segment_size;
+      auto n = first_segment_size << k;
+      if (result.size() < first + n) { result.resize(first + n); }
+      for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t e = 0; e < event_count; ++e) {
+          result[first + i][e] += s[i][e].load(std::memory_order_relaxed);
+        }
+      }
+    }
+  }
+
+  // Drop the trailing types without any event.
+  while (!result.empty() && (result.back() == Counts{})) { result.pop_back(); }
+  return result;
+}
+
+}
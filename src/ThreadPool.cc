@@ -0,0 +1,141 @@
+#include "ThreadPool.h"
+
+#include <stdexcept>
+#include <utility>
+
+namespace xst {
+
+/// The pool whose worker is running on the calling thread, if any.
+thread_local ThreadPool* current_pool = nullptr;
+
+/// The position of the worker running on the calling thread in `current_pool`.
+thread_local std::size_t current_worker = 0;
+
+ThreadPool::ThreadPool(std::size_t thread_count) {
+  auto n = (thread_count == 0) ? 1 : thread_count;
+  for (std::size_t i = 0; i < n; ++i) {
+    queues.push_back(std::make_unique<Queue>());
+  }
+  for (std::size_t i = 1; i < n; ++i) {
+    threads.emplace_back([this, i] { work(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> l{mutex};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto& t : threads) { t.join(); }
+}
+
+void ThreadPool::run(Task root) {
+  if (current_pool == this) {
+    throw std::logic_error("cannot run a task group from a task of the same pool");
+  }
+
+  std::lock_guard<std::mutex> r{run_mutex};
+  auto previous_pool = std::exchange(current_pool, this);
+  auto previous_worker = std::exchange(current_worker, 0);
+
+  // The root is run by the calling thread, so the workers needn't be woken up.
+  pending.store(1, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> l{queues[0]->mutex};
+    queues[0]->tasks.push_back(std::move(root));
+    queued.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // The calling thread takes part in the execution until every task is done, sleeping while all
+  // the remaining tasks are running on other workers.
+  while (true) {
+    if (run_one(0)) { continue; }
+    std::unique_lock<std::mutex> l{mutex};
+    done.wait(l, [&] {
+      return (pending.load(std::memory_order_acquire) == 0)
+        || (queued.load(std::memory_order_relaxed) != 0);
+    });
+    if (pending.load(std::memory_order_acquire) == 0) { break; }
+  }
+
+  current_pool = previous_pool;
+  current_worker = previous_worker;
+
+  std::exception_ptr e;
+  {
+    std::lock_guard<std::mutex> l{mutex};
+    std::swap(e, error);
+  }
+  if (e) { std::rethrow_exception(e); }
+}
+
+void ThreadPool::spawn(Task task) {
+  if (current_pool != this) {
+    throw std::logic_error("cannot spawn a task outside of a task of the same pool");
+  }
+
+  pending.fetch_add(1, std::memory_order_relaxed);
+  {
+    auto& q = *queues[current_worker];
+    std::lock_guard<std::mutex> l{q.mutex};
+    q.tasks.push_back(std::move(task));
+    queued.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Sleeping threads check for tasks while holding the lock, so taking it ensures that they
+  // either see the new task or are waiting when they are notified.
+  { std::lock_guard<std::mutex> l{mutex}; }
+  wake.notify_one();
+  done.notify_one();
+}
+
+bool ThreadPool::run_one(std::size_t i) {
+  Task task;
+
+  // Take the newest task of the worker's own queue, or the oldest task of another queue.
+  for (std::size_t k = 0; (k < queues.size()) && !task; ++k) {
+    auto& q = *queues[(i + k) % queues.size()];
+    std::lock_guard<std::mutex> l{q.mutex};
+    if (q.tasks.empty()) { continue; }
+    if (k == 0) {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    } else {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    queued.fetch_sub(1, std::memory_order_relaxed);
+  }
+  if (!task) { return false; }
+
+  try {
+    task();
+  } catch (...) {
+    std::lock_guard<std::mutex> l{mutex};
+    if (!error) { error = std::current_exception(); }
+  }
+
+  // Releasing the count publishes the effects of the task to the thread waiting in `run`.
+  if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    { std::lock_guard<std::mutex> l{mutex}; }
+    done.notify_one();
+  }
+  return true;
+}
+
+void ThreadPool::work(std::size_t i) {
+  current_pool = this;
+  current_worker = i;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> l{mutex};
+      wake.wait(l, [&] { return stopping || (queued.load(std::memory_order_relaxed) != 0); });
+      if (stopping) { return; }
+    }
+    while (run_one(i)) {}
+  }
+}
+
+}
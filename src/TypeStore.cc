@@ -1,6 +1,8 @@
+#include "Kernels.h"
 #include "TypeHeader.h"
 #include "TypeStore.h"
 
+#include <algorithm>
 #include <cassert>
 
 namespace xst {
@@ -10,97 +12,454 @@ void precondition(bool test, std::string const& error) {
   if (!test) { throw std::logic_error(error); }
 }
 
-/// Allocates `s` bytes of storage aligned `a`, initialized to 0 iff `zero_initialize` is set.
-void* aligned_alloc(std::size_t a, std::size_t s, bool zero_initialize = false) {
-  if (s == 0) { return nullptr; }
+/// Returns the number of bytes before the given fields when they are laid out with `policy`,
+/// reading metatypes from `store`.
+std::vector<std::size_t> offsets(
+  std::vector<Field> const& fields, TypeStore::LayoutPolicy policy, TypeStore const& store
+) {
+  // Determine the order in which fields are stored.
+  std::vector<std::size_t> order(fields.size());
+  for (std::size_t i = 0; i < fields.size(); ++i) { order[i] = i; }
+  if (policy == TypeStore::minimize_padding) {
+    std::stable_sort(order.begin(), order.end(), [&](auto i, auto j) {
+      return store.alignment(fields[i]) > store.alignment(fields[j]);
+    });
+  }
+
+  // Assign offsets in storage order.
+  std::vector<std::size_t> result(fields.size());
+  std::size_t p = 0;
+  for (auto i : order) {
+    auto const& f = fields[i];
+    auto q = round_up_to_nearest_multiple(p, store.alignment(f));
+    result[i] = q;
+    p = q + store.size(f);
+  }
+  return result;
+}
+
+template<typename Allocate>
+void Metatype::initialize(
+  std::size_t size, std::size_t alignment, bool is_trivial, bool is_dense,
+  std::span<Field const> fields,
+  std::span<std::size_t const> offsets,
+  TagEncoding tag,
+  Allocate allocate
+) {
+  static_assert(sizeof(Field) == sizeof(std::size_t));
+  auto field_count = fields.size();
+  precondition(field_count == offsets.size(), "inconsistent fields and offsets");
 
-  using Head = std::size_t;
+  auto n = sizeof(Header) + 2 * field_count * sizeof(std::size_t);
+  auto buffer = static_cast<std::byte*>(allocate(n));
+  auto h = new(buffer) Header{};
+  h->size = size;
+  h->alignment = alignment;
+  h->stride = std::max<std::size_t>(round_up_to_nearest_multiple(size, alignment), 1);
+  h->field_count = field_count;
+  h->tag = tag;
+  h->is_trivial = is_trivial;
+  h->is_dense = is_dense;
+  h->has_out_of_line_fields = std::ranges::any_of(fields, [](auto const& f) {
+    return f.out_of_line();
+  });
+
+  auto b = buffer + sizeof(Header);
+  if (field_count > 0) {
+    std::memcpy(b, fields.data(), field_count * sizeof(Field));
+    std::memcpy(b + field_count * sizeof(Field), offsets.data(), field_count * sizeof(std::size_t));
+  }
+  data = reinterpret_cast<uintptr_t>(buffer);
+}
 
-  auto x = std::max(a, alignof(Head)) - 1;
-  auto b = new std::byte[sizeof(Head) + s + x];
+Metatype::Metatype(
+  std::size_t size, std::size_t alignment, bool trivial,
+  std::vector<Field>&& fields,
+  std::vector<std::size_t>&& offsets,
+  TagEncoding tag
+) {
+  initialize(size, alignment, trivial, false, fields, offsets, tag, [](std::size_t n) {
+    return ::operator new(n, std::align_val_t{payload_alignment});
+  });
+}
 
-  Head offset = round_up_to_nearest_multiple(sizeof(Head), a);
-  auto payload = b + offset;
-  auto head = payload - sizeof(Head);
-  memcpy(head, &offset, sizeof(Head));
+Metatype::Metatype(
+  std::size_t size, std::size_t alignment, bool trivial, bool dense,
+  std::span<Field const> fields,
+  std::span<std::size_t const> offsets,
+  TagEncoding tag,
+  Arena& arena
+) {
+  initialize(size, alignment, trivial, dense, fields, offsets, tag, [&](std::size_t n) {
+    return arena.allocate(n, payload_alignment);
+  });
+  data |= 1;
+}
 
-  if (zero_initialize) {
-    std::memset(payload, 0, s);
+/// Returns `true` iff `x` and `y` contain the same fields.
+bool same_fields(std::span<Field const> x, std::span<Field const> y) {
+  return std::equal(x.begin(), x.end(), y.begin(), y.end(), [](auto const& f, auto const& g) {
+    return f.raw_value == g.raw_value;
+  });
+}
+
+TypeStore::~TypeStore() {
+  for (auto& s : segments) {
+    delete[] s.load(std::memory_order_relaxed);
   }
+}
 
-  return payload;
+TypeStore::Entry* TypeStore::entry_of(TypeHeader const* t) const {
+  auto e = interned_entry(t);
+  if (e != nullptr) { return e; }
+
+  auto& s = shard(t->hash_value());
+  std::lock_guard<std::mutex> l{s.mutex};
+  auto p = s.interned.find(*t);
+  return (p != nullptr) ? entry(p->index) : nullptr;
 }
 
-/// Deallocates memory allocated by `aligned_alloc`.
-///
-/// This function is a no-op if `p` is `nullptr`.
-void aligned_free(void* p) {
-  if (p == nullptr) { return; }
+TypeStore::Entry& TypeStore::get_declared_entry(TypeHeader const* t) const {
+  auto e = entry_of(t);
+  if (e == nullptr) {
+    throw std::out_of_range(t->description() + " is unknown");
+  } else {
+    return *e;
+  }
+}
 
-  using Head = std::size_t;
+TypeStore::Entry const& TypeStore::get_defined_entry(TypeHeader const* t) const {
+  auto e = entry_of(t);
+  if (e != nullptr) {
+    if (!e->is_defined.load(std::memory_order_acquire)) { define_on_demand(*e); }
+    auto d = e->is_defined.load(std::memory_order_acquire);
+    precondition(d, t->description() + " is not defined");
+    return *e;
+  } else {
+    throw std::out_of_range(t->description() + " is unknown");
+  }
+}
+
+void TypeStore::define_on_demand(Entry const& e) const {
+  auto i = e.instantiation.load(std::memory_order_acquire);
+  if (i == nullptr) { return; }
 
-  Head offset;
-  auto payload = static_cast<std::byte*>(p);
-  auto head = payload - sizeof(Head);
-  memcpy(&offset, head, sizeof(Head));
-  auto b = payload - offset;
-  delete[] b;
+  // Defining a type on demand doesn't change the observable state of the store. Threads racing
+  // to define the same instance publish the same definition.
+  auto& store = const_cast<TypeStore&>(*this);
+  i->constructor->define(store, i->type, i->arguments);
 }
 
-/// Returns the number of bytes before the given fields, reading metatypes from `store`.
-std::vector<std::size_t> offsets(
-  std::vector<Field> const& fields, TypeStore const& store
-) {
-  std::vector<std::size_t> result{0};
-  for (auto i = 1; i < fields.size(); ++i) {
-    auto const& f = fields[i];
-    auto p = result.at(i - 1) + store.size(fields[i - 1]);
-    auto q = round_up_to_nearest_multiple(p, store.alignment(f));
-    result.push_back(static_cast<uint32_t>(q));
+TypeStore::WitnessOperations TypeStore::compile(TypeHeader::Kind k, Metatype const& m) const {
+  WitnessOperations result;
+  result.bitwise_equatable = bitwise_equatable(k, m);
+  if (m.is_trivial()) { return result; }
+
+  auto fields = m.fields();
+  if (k == TypeHeader::sum) {
+    // The payload of every case is stored at the base address.
+    for (auto const& f : fields) {
+      compile(f, 0, result.cases.emplace_back());
+    }
+  } else {
+    auto offsets = m.offsets();
+    for (std::size_t i = 0; i < fields.size(); ++i) {
+      compile(fields[i], offsets[i], result.operations);
+    }
   }
   return result;
 }
 
-Metatype::Metatype(
-  std::size_t size, std::size_t alignment, bool trivial,
-  std::vector<Field>&& fields,
-  std::vector<std::size_t>&& offsets
-) {
-  auto field_count = fields.size();
-  precondition(field_count == offsets.size(), "inconsistent fields and offsets");
+void TypeStore::compile(
+  Field const& f, std::size_t offset, std::vector<WitnessTable::Operation>& operations
+) const {
+  auto t = f.type();
+
+  // Out-of-line fields are copied through the table of their type, which needs not be defined yet.
+  if (f.out_of_line()) {
+    auto e = entry_of(t);
+    precondition(e != nullptr, t->description() + " is unknown");
+    auto k = f.shared() ? WitnessTable::Operation::shared_box : WitnessTable::Operation::box;
+    operations.push_back({k, offset, &e->witnesses});
+  }
 
-  // Can we store everything inline?
-  if ((field_count == 0) && !((size | alignment) & ~0xffff) && (sizeof(std::uintptr_t) >= 8)) {
-    data = (size << 32) | (alignment << 16) | (trivial ? 0b11 : 0b01);
+  // Inline sums are dispatched through their own table.
+  else if (is_trivial(t)) {
+    return;
+  } else if (t->kind == TypeHeader::sum) {
+    operations.push_back({WitnessTable::Operation::sum, offset, &witnesses(t)});
   }
 
-  // Use out-of-line storage.
+  // Inline products are flattened.
   else {
-    auto buffer = new std::size_t[3 + field_count + field_count];
-    buffer[0] = size;
-    buffer[1] = alignment;
-    buffer[2] = field_count;
-
-    auto f = fields.begin();
-    auto o = offsets.begin();
-    for (auto i = 0; i < field_count; ++i) {
-      buffer[i + 3] = static_cast<std::size_t>((f++)->raw_value);
-      buffer[i + 3 + field_count] = static_cast<std::size_t>(*(o++));
+    for (auto o : witnesses(t).operations) {
+      o.offset += offset;
+      operations.push_back(o);
     }
+  }
+}
 
-    data = reinterpret_cast<uintptr_t>(buffer) | (trivial ? 0b10 : 0b00);
+bool TypeStore::bitwise_equatable(TypeHeader::Kind k, Metatype const& m) const {
+  switch (k) {
+    case TypeHeader::builtin:
+      return true;
+
+    case TypeHeader::product: {
+      // The fields must be stored inline, be bitwise equatable, and cover the whole instance.
+      std::size_t s = 0;
+      for (auto const& f : m.fields()) {
+        if (f.out_of_line() || !(*this)[f.type()].is_dense()) { return false; }
+        s += size(f);
+      }
+      return s == m.size();
+    }
+
+    case TypeHeader::sum:
+      // The bytes of the payloads of different cases aren't comparable.
+      return false;
   }
+  return false;
 }
 
-Metatype& TypeStore::get_undefined_metatype(TypeHeader const* t) {
-  auto entry = metatype.find(DereferencingKey<TypeHeader>{t});
-  if (entry == metatype.end()) {
-    throw std::out_of_range(t->description() + " is unknown");
-  } else if (entry->second.defined()) {
+TagEncoding TypeStore::niche_encoding(std::span<Field const> cases) const {
+  // Find the only case with a payload.
+  auto p = cases.size();
+  for (std::size_t i = 0; i < cases.size(); ++i) {
+    if (size(cases[i]) == 0) { continue; }
+    if (p != cases.size()) { return {}; }
+    p = i;
+  }
+  if ((p == cases.size()) || (p > UINT16_MAX)) { return {}; }
+
+  auto result = niche(cases[p], 0, cases.size() - 1);
+  result.payload_case = static_cast<uint16_t>(p);
+  return result;
+}
+
+TagEncoding TypeStore::niche(Field const& f, std::size_t offset, std::size_t count) const {
+  TagEncoding result;
+
+  // Out-of-line fields are never null, and boxes are aligned at the alignment of their type, so
+  // the addresses below that alignment are spare. Only built-in types have an alignment known
+  // before they are defined, so the encoding doesn't depend on the order of the definitions.
+  if (f.out_of_line()) {
+    std::size_t spare = 1;
+    if (f.type()->kind == TypeHeader::builtin) {
+      spare = static_cast<BuiltinHeader const*>(f.type())->alignment();
+    }
+    if (count <= spare) {
+      result.offset = static_cast<uint32_t>(offset);
+      result.niche_count = static_cast<uint16_t>(count);
+      result.width = sizeof(void*);
+    }
+    return result;
+  }
+
+  auto t = f.type();
+  switch (t->kind) {
+    case TypeHeader::builtin: {
+      // Booleans only take the values 0 and 1.
+      auto b = static_cast<BuiltinHeader const*>(t);
+      if ((b->raw_value == BuiltinHeader::boolean) && (count <= 254)) {
+        result.offset = static_cast<uint32_t>(offset);
+        result.niche_start = 2;
+        result.niche_count = static_cast<uint16_t>(count);
+        result.width = 1;
+      }
+      return result;
+    }
+
+    case TypeHeader::product: {
+      auto const& m = (*this)[t];
+      auto fields = m.fields();
+      auto offsets = m.offsets();
+      for (std::size_t i = 0; i < fields.size(); ++i) {
+        result = niche(fields[i], offset + offsets[i], count);
+        if (result.uses_niche()) { break; }
+      }
+      return result;
+    }
+
+    case TypeHeader::sum: {
+      // Dedicated tags only take values less than the number of cases.
+      auto const& m = (*this)[t];
+      auto tag = m.tag_encoding();
+      if ((tag.width == 0) || (tag.width >= sizeof(uint64_t)) || tag.uses_niche()) {
+        return result;
+      }
+      auto n = m.fields().size();
+      if (count <= (uint64_t{1} << (8 * tag.width)) - n) {
+        result.offset = static_cast<uint32_t>(offset + tag.offset);
+        result.niche_start = static_cast<uint32_t>(n);
+        result.niche_count = static_cast<uint16_t>(count);
+        result.width = tag.width;
+      }
+      return result;
+    }
+  }
+  return result;
+}
+
+void TypeStore::install(
+  Entry& e, TypeHeader::Kind k, WitnessOperations const& w, Arena& arena
+) const {
+  using Operations = std::span<WitnessTable::Operation const>;
+
+  auto const& m = e.metatype;
+  auto& table = e.witnesses;
+  table.size = m.size();
+  table.alignment = m.alignment();
+  table.bitwise_equatable = w.bitwise_equatable;
+
+  if (k != TypeHeader::sum) {
+    table.operations = arena.copy(Operations{w.operations});
+  } else {
+    std::vector<Operations> cases;
+    for (auto const& c : w.cases) { cases.push_back(arena.copy(Operations{c})); }
+    table.cases = arena.copy(std::span<Operations const>{cases});
+
+    table.tag = m.tag_encoding();
+    if (!m.is_trivial()) {
+      WitnessTable::Operation o{WitnessTable::Operation::sum, 0, &table};
+      table.operations = arena.copy(Operations{&o, 1});
+    }
+  }
+}
+
+void TypeStore::intern(
+  Shard& s, TypeHeader* h, std::size_t hash, Metatype&& m, WitnessOperations const& w,
+  std::string_view description, Instantiation* instantiation
+) {
+  auto i = entry_count.fetch_add(1, std::memory_order_relaxed);
+  auto j = i + first_segment_size;
+  auto k = std::bit_width(j) - std::bit_width(first_segment_size);
+  precondition(k < segment_count, "too many types");
+
+  // Allocate the segment containing the new entry if necessary.
+  auto e = entry(i);
+  if (e == nullptr) {
+    auto segment = new Entry[first_segment_size << k];
+    Entry* expected = nullptr;
+    if (!segments[k].compare_exchange_strong(expected, segment, std::memory_order_acq_rel)) {
+      delete[] segment;
+    }
+    e = entry(i);
+  }
+
+  h->index = i;
+  auto d = s.arena.copy(std::span<char const>{description});
+  e->description = std::string_view{d.data(), d.size()};
+  if (m.defined()) {
+    e->metatype = Metatype{
+      m.size(), m.alignment(), m.is_trivial(), w.bitwise_equatable, m.fields(), m.offsets(),
+      m.tag_encoding(), s.arena};
+    install(*e, h->kind, w, s.arena);
+    instrument(*e, i);
+    e->is_defined.store(true, std::memory_order_release);
+  }
+  if (instantiation != nullptr) {
+    instantiation->type = h;
+    e->instantiation.store(instantiation, std::memory_order_relaxed);
+  }
+  e->header.store(h, std::memory_order_release);
+  s.interned.insert(h, hash);
+}
+
+Metatype const& TypeStore::publish(
+  Entry& e, TypeHeader const* t, Metatype&& m, WitnessOperations const& w
+) {
+  auto& s = shard(t->hash_value());
+  std::lock_guard<std::mutex> l{s.mutex};
+
+  if (!e.is_defined.load(std::memory_order_relaxed)) {
+    e.metatype = Metatype{
+      m.size(), m.alignment(), m.is_trivial(), w.bitwise_equatable, m.fields(), m.offsets(),
+      m.tag_encoding(), s.arena};
+    install(e, t->kind, w, s.arena);
+    instrument(e, e.header.load(std::memory_order_relaxed)->index);
+    e.is_defined.store(true, std::memory_order_release);
+  } else if (
+    !same_fields(e.metatype.fields(), m.fields()) ||
+    !std::ranges::equal(e.metatype.offsets(), m.offsets())
+  ) {
     throw std::logic_error(t->description() + " is already defined");
+  }
+  return e.metatype;
+}
+
+void* TypeStore::allocate_box(TypeHeader const* t, Allocator& a) const {
+  auto const& m = (*this)[t];
+  auto s = m.size();
+  if (s == 0) { return empty_box(); }
+
+  auto p = a.allocate(s, m.alignment());
+  std::memset(p, 0, s);
+  record(Statistics::box_allocation, t->index);
+  record(Statistics::allocated_bytes, t->index, s);
+  return p;
+}
+
+void TypeStore::deallocate_box(TypeHeader const* t, void* p) const {
+  auto const& m = (*this)[t];
+  if ((p == nullptr) || (m.size() == 0)) { return; }
+  record(Statistics::deallocation, t->index);
+  allocator->deallocate(p, m.size(), m.alignment());
+}
+
+void TypeStore::reserve(std::size_t n) {
+  for (auto& s : shards) {
+    std::lock_guard<std::mutex> l{s.mutex};
+    s.interned.reserve(n / shard_count);
+  }
+}
+
+TypeConstructor const* TypeStore::register_constructor(
+  TypeHeader::Kind kind, const char* name, std::size_t arity, TypeConstructor::Definition define
+) {
+  precondition(kind != TypeHeader::builtin, "type constructors can't be built-in");
+  Hasher h;
+  h.combine_bytes(name);
+  auto& s = shard(h.finalize());
+  std::lock_guard<std::mutex> l{s.mutex};
+  return s.arena.create<TypeConstructor>(TypeConstructor{kind, name, arity, define});
+}
+
+TypeHeader const* TypeStore::instantiate(
+  TypeConstructor const* constructor, std::span<TypeHeader const* const> arguments
+) {
+  precondition(
+    arguments.size() == constructor->arity, std::string{constructor->name} + " has wrong arity");
+
+  Hasher h;
+  h.combine_word(reinterpret_cast<uintptr_t>(constructor));
+  for (auto a : arguments) { h.combine_word(reinterpret_cast<uintptr_t>(a)); }
+  Instantiation key{constructor, arguments, h.finalize()};
+  auto& s = shard(key.hash);
+
+  // The instantiation is already known. Memoized instantiations are looked up without locking.
+  if (auto p = s.instantiations.find(key, key.hash); p != nullptr) { return p->type; }
+
+  Instantiation* i;
+  {
+    std::lock_guard<std::mutex> l{s.mutex};
+    if (auto p = s.instantiations.find(key, key.hash); p != nullptr) { return p->type; }
+    key.arguments = s.arena.copy(arguments);
+    i = s.arena.create<Instantiation>(key);
+  }
+
+  // Declare the instance with its instantiation, without holding the lock of `s` as the instance
+  // may be in the same shard, so that it can be defined on demand as soon as it can be found.
+  if (constructor->kind == TypeHeader::product) {
+    declare(StructHeader{constructor->name, arguments.begin(), arguments.end()}, i);
   } else {
-    return entry->second;
+    declare(EnumHeader{constructor->name, arguments.begin(), arguments.end()}, i);
   }
+
+  // Memoize the instantiation unless another thread did so concurrently.
+  std::lock_guard<std::mutex> l{s.mutex};
+  if (auto p = s.instantiations.find(key, key.hash); p != nullptr) { return p->type; }
+  s.instantiations.insert(i, key.hash);
+  return i->type;
 }
 
 StructHeader const* TypeStore::declare_lambda(
@@ -119,30 +478,38 @@ StructHeader const* TypeStore::declare_lambda(
   return h;
 }
 
-Metatype const& TypeStore::define(StructHeader const* t, std::vector<Field>&& fields) {
-  auto& m = get_undefined_metatype(t);
+Metatype const& TypeStore::define(
+  StructHeader const* t, std::vector<Field>&& fields, LayoutPolicy policy
+) {
+  auto& e = get_declared_entry(t);
+  Metatype m;
 
   if (fields.empty()) {
     m = Metatype{0, 1, true, {}, {}};
   } else {
     // Compute field offsets.
-    auto offsets = xst::offsets(fields, *this);
+    auto offsets = xst::offsets(fields, policy, *this);
 
     // Compute size and alignment.
+    std::size_t s = 0;
     std::size_t a = 1;
-    for (auto const& f : fields) { a = std::max(a, alignment(f)); }
-    std::size_t s = size(fields.back()) + offsets.back();
+    for (std::size_t i = 0; i < fields.size(); ++i) {
+      s = std::max(s, offsets[i] + size(fields[i]));
+      a = std::max(a, alignment(fields[i]));
+    }
 
     // Define the metatype.
     auto t = all_trivial(fields);
     m = Metatype{s, a, t, std::move(fields), std::move(offsets)};
   }
 
-  return m;
+  auto w = compile(TypeHeader::product, m);
+  return publish(e, t, std::move(m), w);
 }
 
 Metatype const& TypeStore::define(EnumHeader const* t, std::vector<Field>&& fields) {
-  auto& m = get_undefined_metatype(t);
+  auto& e = get_declared_entry(t);
+  Metatype m;
 
   if (fields.empty()) {
     m = Metatype{0, 1, true, {}, {}};
@@ -159,41 +526,56 @@ Metatype const& TypeStore::define(EnumHeader const* t, std::vector<Field>&& fiel
       s = std::max(s, size(f));
       a = std::max(a, alignment(f));
     }
-    auto tag_offset = round_up_to_nearest_multiple(s, alignof(uint16_t));
-    s = tag_offset + sizeof(uint16_t);
-    a = std::max(a, alignof(uint16_t));
 
-    // Define the metatype.
+    // Store the case in a niche if possible, or in a tag after the largest payload otherwise.
+    auto tag = niche_encoding(fields);
+    if (!tag.uses_niche()) {
+      tag.width = TagEncoding::tag_width(fields.size());
+      std::size_t w = tag.width;
+      tag.offset = static_cast<uint32_t>(round_up_to_nearest_multiple(s, w));
+      s = tag.offset + w;
+      a = std::max(a, w);
+    }
+
+    // Define the metatype. The payload of every case is stored at the base address.
     auto t = all_trivial(fields);
-    m = Metatype{s, a, t, std::move(fields), {0, tag_offset}};
+    std::vector<std::size_t> offsets(fields.size(), 0);
+    m = Metatype{s, a, t, std::move(fields), std::move(offsets), tag};
   }
 
-  return m;
+  auto w = compile(TypeHeader::sum, m);
+  return publish(e, t, std::move(m), w);
 }
 
-Metatype const& TypeStore::operator[](TypeHeader const* t) const {
-  auto entry = metatype.find(DereferencingKey<TypeHeader>{t});
-  if (entry != metatype.end()) {
-    precondition(entry->second.defined(), t->description() + " is not defined");
-    return entry->second;
-  } else {
-    throw std::out_of_range(t->description() + " is unknown");
-  }
-}
-
-void* TypeStore::address_of(Metatype const& m, std::size_t i, void* base) const {
+void* TypeStore::address_of(Metatype const& m, std::size_t i, void* base, Allocator& a) const {
   auto& field = m.fields()[i];
   auto field_address = static_cast<void*>(static_cast<char*>(base) + offset(m, i));
 
-  if (field.out_of_line()) {
+  if (field.shared()) {
+    auto p = static_cast<void**>(field_address);
+    auto const& w = witnesses(field.type());
+
+    // Should the target be allocated?
+    if (*p == nullptr) {
+      *p = allocate_shared_box(w, a);
+      std::memset(*p, 0, w.size);
+    }
+
+    // Should the target be copied before it is written?
+    else if ((w.size != 0) && (reference_count(*p).load(std::memory_order_acquire) > 1)) {
+      auto q = allocate_shared_box(w, a);
+      xst::copy_initialize(w, q, *p, a);
+      release_shared_box(w, *p, a);
+      *p = q;
+    }
+
+    return *p;
+  } else if (field.out_of_line()) {
     auto p = static_cast<void**>(field_address);
 
     // Should the target be allocated?
     if (*p == nullptr) {
-      auto t = field.type();
-      auto s = size(t);
-      auto a = alignment(t);
-      *p = aligned_alloc(a, s, true);
+      *p = allocate_box(field.type(), a);
     }
 
     return *p;
@@ -202,23 +584,18 @@ void* TypeStore::address_of(Metatype const& m, std::size_t i, void* base) const
   }
 }
 
+void* TypeStore::read_address_of(Metatype const& m, std::size_t i, void* base) const {
+  auto& field = m.fields()[i];
+  auto field_address = static_cast<void*>(static_cast<char*>(base) + offset(m, i));
+  return field.out_of_line() ? *static_cast<void**>(field_address) : field_address;
+}
+
 void BuiltinHeader::copy_initialize(void* target, void* source, TypeStore const& s) const {
   s.copy_initialize(this, target, source);
 }
 
 void TypeStore::copy_initialize(StructHeader const* h, void* target, void* source) const {
-  auto const& m = (*this)[h];
-
-  if (m.is_trivial()) {
-    memcpy(target, source, size(h));
-  } else {
-    auto fields = m.fields();
-    for (auto i = 0; i < fields.size(); ++i) {
-      auto t = address_of(m, i, target);
-      auto s = address_of(m, i, source);
-      copy_initialize(fields[i].type(), t, s);
-    }
-  }
+  xst::copy_initialize(witnesses(h), target, source, *allocator);
 }
 
 void StructHeader::copy_initialize(void* target, void* source, TypeStore const& s) const {
@@ -226,25 +603,7 @@ void StructHeader::copy_initialize(void* target, void* source, TypeStore const&
 }
 
 void TypeStore::copy_initialize(EnumHeader const* h, void* target, void* source) const {
-  auto const& m = (*this)[h];
-
-  if (m.is_trivial()) {
-    memcpy(target, source, size(h));
-  } else {
-    auto fields = m.fields();
-    auto tag = static_cast<uint16_t*>(address_of(m, 1, source));
-    auto f = fields[*tag];
-
-    // Copy the payload.
-    auto t0 = address_of(m, 0, target);
-    auto s0 = address_of(m, 0, source);
-    copy_initialize(f.type(), t0, s0);
-
-    // Copy the tag, unless there's only one field.
-    if (fields.size() > 1) {
-      *static_cast<uint16_t*>(address_of(m, 1, target)) = static_cast<uint16_t>(*tag);
-    }
-  }
+  xst::copy_initialize(witnesses(h), target, source, *allocator);
 }
 
 void EnumHeader::copy_initialize(void* target, void* source, TypeStore const& s) const {
@@ -252,17 +611,51 @@ void EnumHeader::copy_initialize(void* target, void* source, TypeStore const& s)
 }
 
 void TypeStore::copy_initialize_enum(
-  EnumHeader const* type, std::size_t tag, void* target, void* source
+  EnumHeader const* type, std::size_t tag, void* target, void* source, Allocator& a
 ) const {
   auto const& m = (*this)[type];
 
   // Copy the payload.
-  auto t0 = address_of(m, 0, target);
-  copy_initialize(m.fields()[tag].type(), t0, source);
+  auto t0 = address_of(m, tag, target, a);
+  xst::copy_initialize(witnesses(m.fields()[tag].type()), t0, source, a);
 
   // Set the tag.
-  auto t1 = static_cast<uint16_t*>(address_of(m, 1, target));
-  *t1 = static_cast<uint16_t>(tag);
+  m.tag_encoding().set_case(target, tag);
+}
+
+void TypeStore::move_initialize_enum(
+  EnumHeader const* type, std::size_t tag, void* target, void* source, Allocator& a
+) const {
+  auto const& m = (*this)[type];
+
+  // Move the payload.
+  auto t0 = address_of(m, tag, target, a);
+  move_initialize(m.fields()[tag].type(), t0, source);
+
+  // Set the tag.
+  m.tag_encoding().set_case(target, tag);
+}
+
+void BuiltinHeader::move_initialize(void* target, void* source, TypeStore const& s) const {
+  s.move_initialize(this, target, source);
+}
+
+void TypeStore::move_initialize(StructHeader const* h, void* target, void* source) const {
+  auto s = size(h);
+  if (s != 0) { memcpy(target, source, s); }
+}
+
+void StructHeader::move_initialize(void* target, void* source, TypeStore const& s) const {
+  s.move_initialize(this, target, source);
+}
+
+void TypeStore::move_initialize(EnumHeader const* h, void* target, void* source) const {
+  auto s = size(h);
+  if (s != 0) { memcpy(target, source, s); }
+}
+
+void EnumHeader::move_initialize(void* target, void* source, TypeStore const& s) const {
+  s.move_initialize(this, target, source);
 }
 
 void BuiltinHeader::deinitialize(void* source, TypeStore const& s) const {
@@ -270,31 +663,15 @@ void BuiltinHeader::deinitialize(void* source, TypeStore const& s) const {
 }
 
 void TypeStore::deinitialize(StructHeader const* h, void* source) const {
-  auto const& m = (*this)[h];
-
-  if (m.is_trivial()) { return; }
-
-  auto fields = m.fields();
-  for (auto i = 0; i < fields.size(); ++i) {
-    auto s = address_of(m, i, source);
-    auto f = fields[i];
-    deinitialize(f, s);
-  }
-};
+  xst::deinitialize(witnesses(h), source, *allocator);
+}
 
 void StructHeader::deinitialize(void* source, TypeStore const& s) const {
   s.deinitialize(this, source);
 };
 
 void TypeStore::deinitialize(EnumHeader const* h, void* source) const {
-  auto const& m = (*this)[h];
-
-  if (m.is_trivial()) { return; }
-
-  auto tag = static_cast<uint16_t*>(address_of(m, 1, source));
-  auto s = address_of(m, 0, source);
-  auto f = m.fields()[*tag];
-  deinitialize(f, s);
+  xst::deinitialize(witnesses(h), source, *allocator);
 }
 
 void EnumHeader::deinitialize(void* source, TypeStore const& s) const {
@@ -302,58 +679,197 @@ void EnumHeader::deinitialize(void* source, TypeStore const& s) const {
 };
 
 void TypeStore::deinitialize(Field const& f, void* s) const {
-  deinitialize(f.type(), s);
-  if (f.out_of_line()) {
-    aligned_free(s);
+  if (f.shared()) {
+    release_shared_box(witnesses(f.type()), s, *allocator);
+  } else {
+    deinitialize(f.type(), s);
+    if (f.out_of_line()) {
+      deallocate_box(f.type(), s);
+    }
   }
 }
 
-void TypeStore::dump_instance(std::ostream& o, BuiltinHeader const* h, void* source) const {
-  switch (h->raw_value) {
-    case BuiltinHeader::boolean:
-      o << (*static_cast<bool*>(source) ? "true" : "false"); break;
-    case BuiltinHeader::i32:
-      o << *static_cast<int32_t*>(source); break;
-    case BuiltinHeader::i64:
-      o << *static_cast<int64_t*>(source); break;
-    case BuiltinHeader::ptr:
-      o << *static_cast<void**>(source); break;
-    case BuiltinHeader::fun:
-      o << *static_cast<AnyFunction*>(source); break;
+bool TypeStore::equal_instances(TypeHeader const* type, void* a, void* b) const {
+  auto const& k = Kernels::native();
+  auto const& w = witnesses(type);
+  if (w.bitwise_equatable) { return k.equal(a, b, w.size); }
+
+  // Parts are compared using an explicit work-list so that deep out-of-line chains don't consume
+  // native stack space.
+  struct Pending { TypeHeader const* type; void* a; void* b; };
+  std::vector<Pending> pending{{type, a, b}};
+
+  while (!pending.empty()) {
+    auto p = pending.back();
+    pending.pop_back();
+
+    auto const& v = witnesses(p.type);
+    if (v.bitwise_equatable) {
+      if (!k.equal(p.a, p.b, v.size)) { return false; }
+      continue;
+    }
+
+    auto const& m = (*this)[p.type];
+    auto push = [&](std::size_t i) {
+      auto x = read_address_of(m, i, p.a);
+      auto y = read_address_of(m, i, p.b);
+      if (x != y) { pending.push_back({m.fields()[i].type(), x, y}); }
+    };
+
+    if (p.type->kind == TypeHeader::sum) {
+      auto c = v.case_of(p.a);
+      if (c != v.case_of(p.b)) { return false; }
+      push(c);
+    } else {
+      for (auto i = m.fields().size(); i > 0; --i) { push(i - 1); }
+    }
   }
+  return true;
 }
 
-void BuiltinHeader::dump_instance(std::ostream& o, void* source, TypeStore const& s) const {
-  s.dump_instance(o, this, source);
-}
+std::size_t TypeStore::hash_instance(TypeHeader const* type, void* source) const {
+  auto const& k = Kernels::native();
+  auto const& w = witnesses(type);
+  if (w.bitwise_equatable) { return static_cast<std::size_t>(k.hash(source, w.size)); }
 
-void TypeStore::dump_instance(std::ostream& o, StructHeader const* h, void* source) const {
-  auto const& m = (*this)[h];
+  // Parts are hashed in the same order as they are compared by `equal_instances`.
+  struct Pending { TypeHeader const* type; void* source; };
+  std::vector<Pending> pending{{type, source}};
+  Hasher h;
 
-  o << h->description() << "(";
-  auto fields = m.fields();
-  for (auto i = 0; i < fields.size(); ++i) {
-    if (i > 0) { o << ", "; }
-    auto s = address_of(m, i, source);
-    dump_instance(o, fields[i].type(), s);
+  while (!pending.empty()) {
+    auto p = pending.back();
+    pending.pop_back();
+
+    auto const& v = witnesses(p.type);
+    if (v.bitwise_equatable) {
+      h.combine_word(k.hash(p.source, v.size));
+      continue;
+    }
+
+    auto const& m = (*this)[p.type];
+    auto push = [&](std::size_t i) {
+      pending.push_back({m.fields()[i].type(), read_address_of(m, i, p.source)});
+    };
+
+    if (p.type->kind == TypeHeader::sum) {
+      auto c = v.case_of(p.source);
+      h.combine_word(c);
+      push(c);
+    } else {
+      for (auto i = m.fields().size(); i > 0; --i) { push(i - 1); }
+    }
   }
-  o << ")";
+  return h.finalize();
 }
 
-void StructHeader::dump_instance(std::ostream& o, void* source, TypeStore const& s) const {
-  s.dump_instance(o, this, source);
+void TypeStore::dump_instance(OutputBuffer& o, TypeHeader const* type, void* source) const {
+  // Parts are written using an explicit work-list so that deep out-of-line chains don't consume
+  // native stack space. An item without type represents a literal.
+  struct Pending { TypeHeader const* type; void* source; char const* literal; };
+  std::vector<Pending> pending{{type, source, nullptr}};
+
+  while (!pending.empty()) {
+    auto p = pending.back();
+    pending.pop_back();
+    if (p.type == nullptr) {
+      o.append(std::string_view{p.literal});
+      continue;
+    }
+
+    switch (p.type->kind) {
+      case TypeHeader::builtin: {
+        switch (static_cast<BuiltinHeader const*>(p.type)->raw_value) {
+          case BuiltinHeader::boolean:
+            o.append(*static_cast<bool*>(p.source) ? "true" : "false"); break;
+          case BuiltinHeader::i32:
+            o.append_integer(*static_cast<int32_t*>(p.source)); break;
+          case BuiltinHeader::i64:
+            o.append_integer(*static_cast<int64_t*>(p.source)); break;
+          case BuiltinHeader::ptr:
+            o.append_address(reinterpret_cast<uintptr_t>(*static_cast<void**>(p.source))); break;
+          case BuiltinHeader::fun:
+            o.append_address(reinterpret_cast<uintptr_t>(*static_cast<AnyFunction*>(p.source)));
+            break;
+        }
+        break;
+      }
+
+      case TypeHeader::product: {
+        auto const& m = (*this)[p.type];
+        auto fields = m.fields();
+        o.append(description(p.type));
+        o.append('(');
+        pending.push_back({nullptr, nullptr, ")"});
+        for (auto i = fields.size(); i > 0; --i) {
+          pending.push_back({fields[i - 1].type(), read_address_of(m, i - 1, p.source), nullptr});
+          if (i > 1) { pending.push_back({nullptr, nullptr, ", "}); }
+        }
+        break;
+      }
+
+      case TypeHeader::sum: {
+        auto const& m = (*this)[p.type];
+        o.append(description(p.type));
+        o.append('(');
+        pending.push_back({nullptr, nullptr, ")"});
+        if (!m.fields().empty()) {
+          auto c = m.tag_encoding().case_of(p.source);
+          pending.push_back({m.fields()[c].type(), read_address_of(m, c, p.source), nullptr});
+        }
+        break;
+      }
+    }
+  }
 }
 
-void TypeStore::dump_instance(std::ostream& o, EnumHeader const* h, void* source) const {
-  auto const& m = (*this)[h];
+#if defined(XST_STATISTICS)
+void TypeStore::dump_statistics(OutputBuffer& o) const {
+  auto counts = statistics();
+  std::vector<std::size_t> types;
+  for (std::size_t i = 0; i < counts.size(); ++i) {
+    if ((counts[i] != Statistics::Counts{}) && (header(i) != nullptr)) { types.push_back(i); }
+  }
+  std::stable_sort(types.begin(), types.end(), [&](auto a, auto b) {
+    auto const& x = counts[a];
+    auto const& y = counts[b];
+    if (x[Statistics::allocated_bytes] != y[Statistics::allocated_bytes]) {
+      return x[Statistics::allocated_bytes] > y[Statistics::allocated_bytes];
+    }
+    return x[Statistics::copied_node] > y[Statistics::copied_node];
+  });
+
+  // Columns are right-aligned on a fixed width that fits the names of all events.
+  constexpr std::size_t width = 16;
+  auto pad = [&](std::size_t n) {
+    for (; n < width; ++n) { o.append(' '); }
+  };
+  for (std::size_t e = 0; e < Statistics::event_count; ++e) {
+    std::string_view n = Statistics::name(static_cast<Statistics::Event>(e));
+    pad(n.size());
+    o.append(n);
+  }
+  o.append("  type\n");
+  for (auto i : types) {
+    for (auto c : counts[i]) {
+      OutputBuffer n;
+      n.append_integer(c);
+      pad(n.view().size());
+      o.append(n.view());
+    }
+    o.append("  ");
+    o.append(description(header(i)));
+    o.append('\n');
+  }
+}
+#endif
 
-  auto tag = static_cast<uint16_t*>(address_of(m, 1, source));
-  auto s = address_of(m, 0, source);
-  auto f = m.fields()[*tag];
+void BuiltinHeader::dump_instance(std::ostream& o, void* source, TypeStore const& s) const {
+  s.dump_instance(o, this, source);
+}
 
-  o << h->description() << "(";
-  dump_instance(o, f.type(), s);
-  o << ")";
+void StructHeader::dump_instance(std::ostream& o, void* source, TypeStore const& s) const {
+  s.dump_instance(o, this, source);
 }
 
 void EnumHeader::dump_instance(std::ostream& o, void* source, TypeStore const& s) const {
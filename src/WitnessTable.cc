@@ -0,0 +1,459 @@
+#include "WitnessTable.h"
+
+#include <algorithm>
+#include <deque>
+#include <new>
+#include <vector>
+
+namespace xst {
+
+/// Returns the offset of the payload of a shared box storing an instance described by `w`.
+inline std::size_t shared_box_offset(WitnessTable const& w) {
+  return std::max(sizeof(ReferenceCount), w.alignment);
+}
+
+/// Deallocates the storage of the shared box whose payload is at `payload`.
+void deallocate_shared_box(WitnessTable const& w, std::byte* payload, Allocator& allocator) {
+  auto o = shared_box_offset(w);
+  reference_count(payload).~ReferenceCount();
+  allocator.deallocate(
+    payload - o, o + w.size, std::max(alignof(ReferenceCount), w.alignment));
+}
+
+/// Hints that the memory at `p` is about to be read.
+inline void prefetch(void const* p) {
+#if defined(__GNUC__)
+  __builtin_prefetch(p);
+#endif
+}
+
+/// A stack of pending work items that only allocates once it outgrows its inline capacity.
+template<typename T>
+struct WorkList {
+
+  /// The number of items that can be stored without allocating.
+  static constexpr std::size_t inline_capacity = 32;
+
+  /// The items stored inline.
+  T buffer[inline_capacity];
+
+  /// The number of items in `buffer`.
+  std::size_t count = 0;
+
+  /// The items that did not fit in `buffer`.
+  std::vector<T> spill;
+
+  /// Returns `true` iff `this` is empty.
+  inline bool empty() const {
+    return count == 0;
+  }
+
+  /// Adds `item` on top of `this`.
+  inline void push(T const& item) {
+    if (count < inline_capacity) {
+      buffer[count++] = item;
+    } else {
+      spill.push_back(item);
+      ++count;
+    }
+  }
+
+  /// Removes and returns the item on top of `this`.
+  ///
+  /// - Requires: `this` is not empty.
+  inline T pop() {
+    if (count-- > inline_capacity) {
+      auto item = spill.back();
+      spill.pop_back();
+      return item;
+    } else {
+      return buffer[count];
+    }
+  }
+
+};
+
+/// A stack of pending work items whose oldest half can be handed over to another worker.
+template<typename T>
+struct SplittableWorkList {
+
+  /// The items, oldest first.
+  std::deque<T> items;
+
+  /// Returns `true` iff `this` is empty.
+  inline bool empty() const {
+    return items.empty();
+  }
+
+  /// Returns the number of items in `this`.
+  inline std::size_t size() const {
+    return items.size();
+  }
+
+  /// Adds `item` on top of `this`.
+  inline void push(T const& item) {
+    items.push_back(item);
+  }
+
+  /// Removes and returns the item on top of `this`.
+  ///
+  /// - Requires: `this` is not empty.
+  inline T pop() {
+    auto item = items.back();
+    items.pop_back();
+    return item;
+  }
+
+  /// Removes and returns the oldest half of the items in `this`.
+  ///
+  /// The oldest items are the closest to the root of the traversal, and so likely the ones
+  /// leading to the most work.
+  inline SplittableWorkList split() {
+    auto n = items.size() / 2;
+    SplittableWorkList result;
+    result.items.assign(items.begin(), items.begin() + n);
+    items.erase(items.begin(), items.begin() + n);
+    return result;
+  }
+
+};
+
+/// The number of parts that a parallel task fixes up before handing over some of its pending work
+/// to other workers.
+constexpr std::size_t parallel_grain = 256;
+
+/// An out-of-line instance that has been copied bitwise but whose parts must still be fixed up.
+struct PendingCopy {
+
+  /// The table describing the instance.
+  WitnessTable const* witnesses;
+
+  /// The address of the copy.
+  std::byte* target;
+
+  /// The address of the original.
+  std::byte const* source;
+
+};
+
+/// An out-of-line instance whose parts must be destroyed before its storage is deallocated.
+struct PendingDestruction {
+
+  /// The table describing the instance.
+  WitnessTable const* witnesses;
+
+  /// The address of the instance.
+  std::byte* source;
+
+  /// `true` iff the instance is the payload of a shared box.
+  bool shared;
+
+};
+
+/// Applies `operations` to fix up the bitwise copy at `target` of the value at `source`, adding
+/// the out-of-line parts of the copy that must be fixed up in turn to `pending`.
+///
+/// Only the nesting of inline sums, which is bounded by the type of the value, causes recursion.
+template<typename L>
+void copy_parts(
+  std::span<WitnessTable::Operation const> operations,
+  std::byte* target, std::byte const* source, Allocator& allocator, L& pending
+) {
+  for (auto const& o : operations) {
+    auto const& w = *o.witnesses;
+    switch (o.kind) {
+      case WitnessTable::Operation::box: {
+        auto s = static_cast<std::byte const*>(load_pointer(source + o.offset));
+        if ((s == nullptr) || (w.size == 0)) { break; }
+        prefetch(s);
+        auto t = static_cast<std::byte*>(allocator.allocate(w.size, w.alignment));
+        std::memcpy(t, s, w.size);
+        w.record(Statistics::box_allocation);
+        w.record(Statistics::allocated_bytes, w.size);
+        w.record(Statistics::copied_node);
+        store_pointer(target + o.offset, t);
+        if (!w.operations.empty()) { pending.push({&w, t, s}); }
+        break;
+      }
+
+      case WitnessTable::Operation::shared_box: {
+        // The pointer has been copied with the inline representation.
+        auto s = static_cast<std::byte*>(load_pointer(source + o.offset));
+        if ((s == nullptr) || (w.size == 0)) { break; }
+        if (allocator.can_share(s)) {
+          reference_count(s).fetch_add(1, std::memory_order_relaxed);
+          break;
+        }
+
+        // The copy can't refer to a box that `allocator` won't release.
+        auto t = static_cast<std::byte*>(allocate_shared_box(w, allocator));
+        std::memcpy(t, s, w.size);
+        w.record(Statistics::copied_node);
+        store_pointer(target + o.offset, t);
+        if (!w.operations.empty()) { pending.push({&w, t, s}); }
+        break;
+      }
+
+      case WitnessTable::Operation::sum: {
+        auto s = source + o.offset;
+        copy_parts(w.cases[w.case_of(s)], target + o.offset, s, allocator, pending);
+        break;
+      }
+    }
+  }
+}
+
+/// Applies `operations` to fix up the bitwise copy at `target` of the value at `source`.
+void copy_parts(
+  std::span<WitnessTable::Operation const> operations,
+  std::byte* target, std::byte const* source, Allocator& allocator
+) {
+  WorkList<PendingCopy> pending;
+  copy_parts(operations, target, source, allocator, pending);
+  while (!pending.empty()) {
+    auto p = pending.pop();
+    copy_parts(p.witnesses->operations, p.target, p.source, allocator, pending);
+  }
+}
+
+/// Applies `operations` to destroy the inline parts of the value at `source`, adding its
+/// out-of-line parts to `pending`.
+///
+/// Only the nesting of inline sums, which is bounded by the type of the value, causes recursion.
+template<typename L>
+void deinitialize_parts(
+  std::span<WitnessTable::Operation const> operations, std::byte* source, L& pending
+) {
+  for (auto const& o : operations) {
+    auto const& w = *o.witnesses;
+    switch (o.kind) {
+      case WitnessTable::Operation::box: {
+        auto s = static_cast<std::byte*>(load_pointer(source + o.offset));
+        if ((s == nullptr) || (w.size == 0)) { break; }
+        prefetch(s);
+        pending.push({&w, s, false});
+        break;
+      }
+
+      case WitnessTable::Operation::shared_box: {
+        auto s = static_cast<std::byte*>(load_pointer(source + o.offset));
+        if ((s == nullptr) || (w.size == 0)) { break; }
+        if (reference_count(s).fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          pending.push({&w, s, true});
+        }
+        break;
+      }
+
+      case WitnessTable::Operation::sum: {
+        auto s = source + o.offset;
+        deinitialize_parts(w.cases[w.case_of(s)], s, pending);
+        break;
+      }
+    }
+  }
+}
+
+/// Destroys the parts of the out-of-line instance described by `p`, adding its out-of-line parts
+/// to `pending`, and then deallocates its storage.
+template<typename L>
+void destroy(PendingDestruction const& p, Allocator& allocator, L& pending) {
+  // The parts of a box are collected before its storage is deallocated.
+  auto const& w = *p.witnesses;
+  deinitialize_parts(w.operations, p.source, pending);
+  w.record(Statistics::deallocation);
+  if (p.shared) {
+    deallocate_shared_box(w, p.source, allocator);
+  } else {
+    allocator.deallocate(p.source, w.size, w.alignment);
+  }
+}
+
+/// Applies `operations` to destroy the parts of the value at `source`.
+void deinitialize_parts(
+  std::span<WitnessTable::Operation const> operations, std::byte* source, Allocator& allocator
+) {
+  WorkList<PendingDestruction> pending;
+  deinitialize_parts(operations, source, pending);
+  while (!pending.empty()) {
+    destroy(pending.pop(), allocator, pending);
+  }
+}
+
+void* allocate_shared_box(WitnessTable const& witnesses, Allocator& allocator) {
+  if (witnesses.size == 0) { return empty_box(); }
+  auto o = shared_box_offset(witnesses);
+  auto p = static_cast<std::byte*>(allocator.allocate(
+    o + witnesses.size, std::max(alignof(ReferenceCount), witnesses.alignment)));
+  witnesses.record(Statistics::box_allocation);
+  witnesses.record(Statistics::allocated_bytes, o + witnesses.size);
+  new(p + o - sizeof(ReferenceCount)) ReferenceCount{1};
+  return p + o;
+}
+
+void release_shared_box(WitnessTable const& witnesses, void* payload, Allocator& allocator) {
+  if ((payload == nullptr) || (witnesses.size == 0)) { return; }
+  if (reference_count(payload).fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    auto p = static_cast<std::byte*>(payload);
+    deinitialize_parts(witnesses.operations, p, allocator);
+    witnesses.record(Statistics::deallocation);
+    deallocate_shared_box(witnesses, p, allocator);
+  }
+}
+
+void copy_initialize(
+  WitnessTable const& witnesses, void* target, void const* source, Allocator& allocator
+) {
+  if (witnesses.size == 0) { return; }
+  std::memcpy(target, source, witnesses.size);
+  witnesses.record(Statistics::copied_node);
+  copy_parts(
+    witnesses.operations,
+    static_cast<std::byte*>(target), static_cast<std::byte const*>(source), allocator);
+}
+
+void deinitialize(WitnessTable const& witnesses, void* source, Allocator& allocator) {
+  deinitialize_parts(witnesses.operations, static_cast<std::byte*>(source), allocator);
+}
+
+void copy_initialize_n(
+  WitnessTable const& witnesses, void* target, void const* source, std::size_t count,
+  Allocator& allocator
+) {
+  // The inline representations of all instances are copied at once, padding included.
+  auto n = witnesses.extent(count);
+  if (n == 0) { return; }
+  std::memcpy(target, source, n);
+  witnesses.record(Statistics::copied_node, count);
+  if (witnesses.operations.empty()) { return; }
+
+  auto t = static_cast<std::byte*>(target);
+  auto s = static_cast<std::byte const*>(source);
+  auto d = witnesses.stride();
+  for (std::size_t i = 0; i < count; ++i) {
+    copy_parts(witnesses.operations, t + i * d, s + i * d, allocator);
+  }
+}
+
+void deinitialize_n(
+  WitnessTable const& witnesses, void* source, std::size_t count, Allocator& allocator
+) {
+  if (witnesses.operations.empty()) { return; }
+
+  auto s = static_cast<std::byte*>(source);
+  auto d = witnesses.stride();
+  for (std::size_t i = 0; i < count; ++i) {
+    deinitialize_parts(witnesses.operations, s + i * d, allocator);
+  }
+}
+
+/// Fixes up the copies in `pending`, and those of their out-of-line parts, as a task of `pool`,
+/// handing over the oldest half of its pending work to another task every `parallel_grain` parts.
+void copy_task(SplittableWorkList<PendingCopy> pending, Allocator& allocator, ThreadPool& pool) {
+  std::size_t n = 0;
+  while (!pending.empty()) {
+    auto p = pending.pop();
+    copy_parts(p.witnesses->operations, p.target, p.source, allocator, pending);
+    if ((++n >= parallel_grain) && (pending.size() > 1)) {
+      n = 0;
+      pool.spawn([s = pending.split(), &allocator, &pool]() mutable {
+        copy_task(std::move(s), allocator, pool);
+      });
+    }
+  }
+}
+
+/// Destroys the instances in `pending`, and their out-of-line parts, as a task of `pool`, handing
+/// over the oldest half of its pending work to another task every `parallel_grain` parts.
+void destroy_task(
+  SplittableWorkList<PendingDestruction> pending, Allocator& allocator, ThreadPool& pool
+) {
+  std::size_t n = 0;
+  while (!pending.empty()) {
+    destroy(pending.pop(), allocator, pending);
+    if ((++n >= parallel_grain) && (pending.size() > 1)) {
+      n = 0;
+      pool.spawn([s = pending.split(), &allocator, &pool]() mutable {
+        destroy_task(std::move(s), allocator, pool);
+      });
+    }
+  }
+}
+
+/// Returns the number of instances processed by each task of a batch operation on `count`
+/// instances run by `pool`.
+inline std::size_t batch_grain(std::size_t count, ThreadPool& pool) {
+  // Tasks are smaller than an even share so that stealing can balance uneven instances.
+  return std::max<std::size_t>(1, count / (4 * pool.size()));
+}
+
+void copy_initialize(
+  WitnessTable const& witnesses, void* target, void const* source, Allocator& allocator,
+  ThreadPool& pool
+) {
+  copy_initialize_n(witnesses, target, source, 1, allocator, pool);
+}
+
+void deinitialize(
+  WitnessTable const& witnesses, void* source, Allocator& allocator, ThreadPool& pool
+) {
+  deinitialize_n(witnesses, source, 1, allocator, pool);
+}
+
+void copy_initialize_n(
+  WitnessTable const& witnesses, void* target, void const* source, std::size_t count,
+  Allocator& allocator, ThreadPool& pool
+) {
+  auto n = witnesses.extent(count);
+  if (n == 0) { return; }
+  std::memcpy(target, source, n);
+  witnesses.record(Statistics::copied_node, count);
+  if (witnesses.operations.empty()) { return; }
+
+  auto t = static_cast<std::byte*>(target);
+  auto s = static_cast<std::byte const*>(source);
+  auto d = witnesses.stride();
+  auto g = batch_grain(count, pool);
+  auto chunk = [&](std::size_t i) {
+    SplittableWorkList<PendingCopy> pending;
+    for (auto j = i; j < std::min(i + g, count); ++j) {
+      copy_parts(witnesses.operations, t + j * d, s + j * d, allocator, pending);
+    }
+    copy_task(std::move(pending), allocator, pool);
+  };
+
+  // The root processes the first chunk itself, so that copying a small value wakes no worker.
+  pool.run([&] {
+    for (auto i = g; i < count; i += g) {
+      pool.spawn([&, i] { chunk(i); });
+    }
+    chunk(0);
+  });
+}
+
+void deinitialize_n(
+  WitnessTable const& witnesses, void* source, std::size_t count, Allocator& allocator,
+  ThreadPool& pool
+) {
+  if (witnesses.operations.empty()) { return; }
+
+  auto s = static_cast<std::byte*>(source);
+  auto d = witnesses.stride();
+  auto g = batch_grain(count, pool);
+  auto chunk = [&](std::size_t i) {
+    SplittableWorkList<PendingDestruction> pending;
+    for (auto j = i; j < std::min(i + g, count); ++j) {
+      deinitialize_parts(witnesses.operations, s + j * d, pending);
+    }
+    destroy_task(std::move(pending), allocator, pool);
+  };
+
+  // The root processes the first chunk itself, so that destroying a small value wakes no worker.
+  pool.run([&] {
+    for (auto i = g; i < count; i += g) {
+      pool.spawn([&, i] { chunk(i); });
+    }
+    chunk(0);
+  });
+}
+
+}
@@ -1,42 +1,492 @@
 #include "Indirect.h"
+#include "Kernels.h"
+#include "Lambda.h"
+#include "MappedFile.h"
+#include "Serialization.h"
 #include "TypeStore.h"
+#include "TypedView.h"
 
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 namespace rt {
 
 static xst::TypeStore store;
 
-xst::TypeHeader const* ListCons(xst::TypeHeader const* T);
+extern xst::TypeConstructor const* const list;
 
-xst::TypeHeader const* ListEmpty(xst::TypeHeader const* T);
+/// The generic type `List.Cons`.
+xst::TypeConstructor const* const list_cons = store.register_constructor(
+  xst::TypeHeader::product, "List.Cons", 1,
+  [](xst::TypeStore& s, xst::TypeHeader const* t, std::span<xst::TypeHeader const* const> a) {
+    auto _1 = s.instantiate(list, {a[0]});
+    s.define(static_cast<xst::StructHeader const*>(t), {xst::Field{a[0]}, xst::Field{_1, true}});
+  });
+
+/// The generic type `List.Empty`.
+xst::TypeConstructor const* const list_empty = store.register_constructor(
+  xst::TypeHeader::product, "List.Empty", 1,
+  [](xst::TypeStore& s, xst::TypeHeader const* t, std::span<xst::TypeHeader const* const>) {
+    s.define(static_cast<xst::StructHeader const*>(t), {});
+  });
+
+/// The generic type `List`.
+xst::TypeConstructor const* const list = store.register_constructor(
+  xst::TypeHeader::sum, "List", 1,
+  [](xst::TypeStore& s, xst::TypeHeader const* t, std::span<xst::TypeHeader const* const> a) {
+    auto _1 = s.instantiate(list_cons, {a[0]});
+    auto _2 = s.instantiate(list_empty, {a[0]});
+    s.define(static_cast<xst::EnumHeader const*>(t), {xst::Field{_1}, xst::Field{_2}});
+  });
 
 xst::EnumHeader const* List(xst::TypeHeader const* T) {
-  auto _0 = store.declare(xst::EnumHeader("List", {T}));
-  if (!store.defined(_0)) {
-    auto _1 = ListCons(T);
-    auto _2 = ListEmpty(T);
-    store.define(_0, std::vector{xst::Field{_1}, xst::Field{_2}});
-  }
-  return _0;
+  return static_cast<xst::EnumHeader const*>(store.instantiate(list, {T}));
 }
 
 xst::TypeHeader const* ListCons(xst::TypeHeader const* T) {
-  auto _0 = store.declare(xst::StructHeader("List.Cons", {T}));
-  if (!store.defined(_0)) {
-    auto _1 = store.declare(xst::EnumHeader("List", {T}));
-    store.define(_0, std::vector{xst::Field{T}, xst::Field{_1, true}});
-  }
-  return _0;
+  return store.instantiate(list_cons, {T});
 }
 
 xst::TypeHeader const* ListEmpty(xst::TypeHeader const* T) {
-  auto _0 = store.declare(xst::StructHeader("List.Empty", {T}));
-  if (!store.defined(_0)) {
-    store.define(_0, {});
+  return store.instantiate(list_empty, {T});
+}
+
+/// Initializes `target` with the `List<i64>` containing `count - 1, ..., 1, 0`.
+///
+/// The list is built from its end, moving the tail into each new node, so that no part is copied.
+void build_list(void* target, std::int64_t count) {
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  auto list = List(i64);
+  auto cons = ListCons(i64);
+  auto empty = ListEmpty(i64);
+
+  store.with_temporary_allocation(empty, 1, [&](void* e) {
+    store.copy_initialize_enum(list, 1, target, e);
+    store.deinitialize(empty, e);
+  });
+  for (std::int64_t i = 0; i < count; ++i) {
+    store.with_temporary_allocation(cons, 1, [&](void* c) {
+      store.copy_initialize_builtin<std::int64_t>(i64, store.address_of(cons, 0, c), i);
+      store.move_initialize(list, store.address_of(cons, 1, c), target);
+      store.move_initialize_enum(list, 0, target, c);
+    });
   }
-  return _0;
+}
+
+/// Returns `true` iff the kernels of every instruction set supported by the executing CPU compute
+/// the same results as the portable ones, reporting mismatches to the standard error.
+///
+/// Buffers of 0 to 1500 bytes are checked at offsets 0 to 4 from the start of an allocation, so
+/// that the vector loops, their scalar tails, and unaligned accesses are all exercised.
+bool verify_kernels() {
+  auto const& portable = *xst::Kernels::with(xst::Kernels::portable);
+  std::mt19937_64 random{1};
+  std::size_t const max_count = 1500;
+  std::size_t const max_offset = 4;
+  std::size_t const widths[] = {1, 2, 3, 4, 8, 16};
+
+  std::vector<std::byte> a(max_count + max_offset);
+  for (auto& x : a) { x = static_cast<std::byte>(random()); }
+  std::vector<std::byte> b(a.size());
+  std::vector<std::byte> expected(max_count * 16 + 2 * max_offset);
+  std::vector<std::byte> actual(expected.size());
+  std::byte value[16];
+  for (auto& x : value) { x = static_cast<std::byte>(random()); }
+
+  auto ok = true;
+  auto report = [&](char const* kernel, xst::Kernels const& k, std::size_t n, std::size_t o) {
+    std::cerr << kernel << " disagrees with the portable kernel for instruction set "
+      << static_cast<int>(k.instruction_set) << " (length " << n << ", offset " << o << ")"
+      << std::endl;
+    ok = false;
+  };
+
+  auto sets = {xst::Kernels::sse2, xst::Kernels::avx2, xst::Kernels::avx512, xst::Kernels::neon};
+  for (auto s : sets) {
+    auto k = xst::Kernels::with(s);
+    if (k == nullptr) { continue; }
+
+    for (std::size_t n = 0; n <= max_count; ++n) {
+      for (std::size_t o = 0; o <= max_offset; ++o) {
+        auto seed = random();
+        if (k->hash(a.data() + o, n, seed) != portable.hash(a.data() + o, n, seed)) {
+          report("hash", *k, n, o);
+        }
+
+        // Buffers that are equal, then that differ by one bit in the first, last, or some byte.
+        b = a;
+        if (!k->equal(a.data() + o, b.data() + o, n)) { report("equal", *k, n, o); }
+        if (n != 0) {
+          for (auto i : {std::size_t{0}, n - 1, static_cast<std::size_t>(random() % n)}) {
+            b[o + i] ^= static_cast<std::byte>(1 << (random() % 8));
+            if (k->equal(a.data() + o, b.data() + o, n)) { report("equal", *k, n, o); }
+            b[o + i] = a[o + i];
+          }
+        }
+
+        // The bytes surrounding the filled range are compared too, to catch overruns.
+        for (auto w : widths) {
+          auto m = n * w + 2 * max_offset;
+          std::fill_n(expected.begin(), m, std::byte{0});
+          std::fill_n(actual.begin(), m, std::byte{0});
+          portable.fill(expected.data() + o, value, w, n);
+          k->fill(actual.data() + o, value, w, n);
+          if (!std::equal(expected.begin(), expected.begin() + m, actual.begin())) {
+            report("fill", *k, n, o);
+          }
+        }
+      }
+    }
+  }
+  return ok;
+}
+
+/// Returns `true` iff a `List<i64>` of a million elements survives a round trip through its image
+/// and can be read in place from the image, reporting failures to the standard error.
+bool verify_serialization() {
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  auto list = List(i64);
+  auto cons = ListCons(i64);
+  std::int64_t const count = 1'000'000;
+
+  auto ok = true;
+  auto check = [&](bool condition, char const* message) {
+    if (!condition) {
+      std::cerr << message << std::endl;
+      ok = false;
+    }
+  };
+
+  store.with_temporary_allocation(list, 2, [&](void* p) {
+    auto source = p;
+    auto target = static_cast<std::byte*>(p) + store.stride(list);
+    build_list(source, count);
+
+    auto image = xst::serialize(store, list, source);
+    xst::deserialize(store, list, target, image);
+    check(store.equal_instances(list, source, target), "the deserialized list isn't equal");
+    check(
+      store.hash_instance(list, source) == store.hash_instance(list, target),
+      "the deserialized list has another hash");
+
+    // Walk the image in place, from a copy aligned as required by `SerializedValue`.
+    std::vector<std::max_align_t> aligned(image.size() / sizeof(std::max_align_t) + 1);
+    std::memcpy(aligned.data(), image.data(), image.size());
+    auto bytes = std::span{reinterpret_cast<std::byte const*>(aligned.data()), image.size()};
+    xst::SerializedValue value{store, list, bytes};
+    auto const& w = store.witnesses(list);
+    auto q = value.base();
+    auto expected = count;
+    while ((expected != 0) && (w.case_of(q) == 0)) {
+      auto node = value.address_of(list, 0, q);
+      if (*static_cast<std::int64_t const*>(value.address_of(cons, 0, node)) != expected - 1) {
+        break;
+      }
+      --expected;
+      q = value.address_of(cons, 1, node);
+    }
+    check((expected == 0) && (w.case_of(q) == 1), "the list read in place isn't equal");
+
+    // A truncated image must be rejected rather than read out of bounds.
+    try {
+      xst::SerializedValue truncated{store, list, bytes.first(bytes.size() - 1)};
+      check(false, "a truncated image was accepted");
+    } catch (std::invalid_argument const&) {}
+
+    store.deinitialize(list, source);
+    store.deinitialize(list, target);
+  });
+  return ok;
+}
+
+/// Returns `true` iff images whose out-of-line parts alias each other are rejected, unless they
+/// are shared boxes of the same type, reporting failures to the standard error.
+bool verify_aliased_images() {
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  auto cell = store.declare(xst::StructHeader{"Cell", {}});
+  store.define(cell, {xst::Field{i64}});
+  auto unit = store.declare(xst::StructHeader{"Unit", {}});
+  store.define(unit, {});
+
+  // Two unique boxes, two shared boxes of different types, and a box without size.
+  auto parts = store.declare(xst::StructHeader{"Parts", {}});
+  store.define(parts, {
+    xst::Field{i64, true}, xst::Field{i64, true},
+    xst::Field{i64, true, true}, xst::Field{cell, true, true}, xst::Field{unit, true}});
+
+  auto ok = true;
+  store.with_temporary_allocation(parts, 2, [&](void* p) {
+    auto source = static_cast<std::byte*>(p);
+    auto target = source + store.stride(parts);
+    for (std::size_t i = 0; i < 4; ++i) {
+      auto f = store.address_of(parts, i, source);
+      store.copy_initialize_builtin<std::int64_t>(i64, f, static_cast<std::int64_t>(i));
+    }
+    store.address_of(parts, 4, source);
+    auto image = xst::serialize(store, parts, source);
+
+    xst::deserialize(store, parts, target, image);
+    if (!store.equal_instances(parts, source, target)) {
+      std::cerr << "the deserialized parts aren't equal" << std::endl;
+      ok = false;
+    }
+    store.deinitialize(parts, target);
+
+    // Redirects the relative offset of the `i`-th field to the part of the `j`-th field.
+    auto const& m = store[parts];
+    auto alias = [&](std::size_t i, std::size_t j) {
+      auto copy = image;
+      auto a = store.offset(m, i);
+      auto b = store.offset(m, j);
+      std::ptrdiff_t r;
+      std::memcpy(&r, copy.data() + b, sizeof(r));
+      r += static_cast<std::ptrdiff_t>(b) - static_cast<std::ptrdiff_t>(a);
+      std::memcpy(copy.data() + a, &r, sizeof(r));
+      return copy;
+    };
+
+    for (auto [i, j] : {std::pair{1, 0}, std::pair{3, 2}, std::pair{2, 0}}) {
+      try {
+        xst::deserialize(store, parts, target, alias(i, j));
+        store.deinitialize(parts, target);
+        std::cerr << "an image aliasing fields " << i << " and " << j << " was accepted"
+          << std::endl;
+        ok = false;
+      } catch (std::invalid_argument const&) {}
+    }
+    store.deinitialize(parts, source);
+  });
+  return ok;
+}
+
+/// Returns `true` iff the types of the demo's store are restored identically from a snapshot read
+/// from a mapped file, and values can be exchanged between both stores, reporting failures to the
+/// standard error.
+bool verify_snapshots() {
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  auto boolean = store.declare(xst::BuiltinHeader::boolean);
+  auto list = List(i64);
+  auto unit = store.declare(xst::StructHeader{"Unit", {}});
+  if (!store.defined(unit)) { store.define(unit, {}); }
+
+  // Trivial sums, whose case is stored in a dedicated tag or in a niche of a `boolean`.
+  auto either = store.declare(xst::EnumHeader{"Either", {i64, i64}});
+  if (!store.defined(either)) { store.define(either, {xst::Field{i64}, xst::Field{i64}}); }
+  auto optional = store.declare(xst::EnumHeader{"Optional", {boolean}});
+  if (!store.defined(optional)) {
+    store.define(optional, {xst::Field{unit}, xst::Field{boolean}});
+  }
+
+  auto ok = true;
+  auto check = [&](bool condition, std::string const& message) {
+    if (!condition) {
+      std::cerr << message << std::endl;
+      ok = false;
+    }
+  };
+
+  auto path = std::filesystem::temp_directory_path() / "xst-verify.snapshot";
+  {
+    auto bytes = store.snapshot();
+    std::ofstream o{path, std::ios::binary};
+    auto n = static_cast<std::streamsize>(bytes.size());
+    o.write(reinterpret_cast<char const*>(bytes.data()), n);
+  }
+
+  xst::TypeStore restored;
+  try {
+    xst::MappedFile file{path.c_str()};
+    restored.restore(file.contents());
+  } catch (std::exception const& e) {
+    std::filesystem::remove(path);
+    check(false, std::string{"the snapshot was rejected: "} + e.what());
+    return ok;
+  }
+  std::filesystem::remove(path);
+
+  // Every type has the same ID, header, and layout in both stores. Headers are compared by
+  // description, as their arguments are interned in different stores.
+  for (std::size_t i = 0; auto h = store.header(i); ++i) {
+    auto r = restored.header(i);
+    auto same = (r != nullptr) && (r->kind == h->kind) && (r->hash_value() == h->hash_value())
+      && (r->description() == h->description());
+    if (!same) {
+      check(false, h->description() + " wasn't restored");
+      continue;
+    }
+    if (store.defined(h) != restored.defined(r)) {
+      check(false, h->description() + " wasn't restored as defined");
+    } else if (store.defined(h)) {
+      auto const& a = store[h];
+      auto const& b = restored[r];
+      auto const& s = a.tag_encoding();
+      auto const& t = b.tag_encoding();
+      check(
+        (a.size() == b.size()) && (a.alignment() == b.alignment())
+          && (a.is_trivial() == b.is_trivial()) && (s.offset == t.offset)
+          && (s.niche_start == t.niche_start) && (s.payload_case == t.payload_case)
+          && (s.niche_count == t.niche_count) && (s.width == t.width)
+          && std::ranges::equal(a.offsets(), b.offsets()),
+        h->description() + " wasn't restored with the same layout");
+    }
+  }
+
+  // A value moves between the stores through its image, which relies on their witness tables.
+  auto restored_i64 = restored.declare(xst::BuiltinHeader::i64);
+  auto restored_list = restored.declare(xst::EnumHeader{"List", {restored_i64}});
+  check(restored.defined(restored_list), "List<i64> isn't defined after restoring");
+  if (!ok) { return ok; }
+
+  store.with_temporary_allocation(list, 1, [&](void* source) {
+    build_list(source, 3);
+    restored.with_temporary_allocation(restored_list, 1, [&](void* target) {
+      xst::deserialize(restored, restored_list, target, xst::serialize(store, list, source));
+      check(
+        restored.describe_instance(restored_list, target) == store.describe_instance(list, source),
+        "a list moved to the restored store isn't equal");
+      restored.deinitialize(restored_list, target);
+    });
+    store.deinitialize(list, source);
+  });
+  return ok;
+}
+
+/// Returns `true` iff typed layouts bind native types only to trivial types that aren't structs
+/// or enums, and bind nested structs through their own layouts, reporting failures to the
+/// standard error.
+bool verify_typed_layouts() {
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  auto boolean = store.declare(xst::BuiltinHeader::boolean);
+  auto cell = store.declare(xst::StructHeader{"Cell", {}});
+  if (!store.defined(cell)) { store.define(cell, {xst::Field{i64}}); }
+  auto unit = store.declare(xst::StructHeader{"Unit", {}});
+  if (!store.defined(unit)) { store.define(unit, {}); }
+  auto optional = store.declare(xst::EnumHeader{"Optional", {boolean}});
+  if (!store.defined(optional)) {
+    store.define(optional, {xst::Field{unit}, xst::Field{boolean}});
+  }
+
+  // A struct and an enum whose sizes and alignments are those of native integers.
+  auto outer = store.declare(xst::StructHeader{"Outer", {}});
+  store.define(outer, {xst::Field{cell}, xst::Field{i64}});
+  auto holder = store.declare(xst::StructHeader{"Holder", {}});
+  store.define(holder, {xst::Field{optional}});
+
+  auto ok = true;
+  auto rejects = [&]<typename L>(xst::TypeHeader const* t, L*) {
+    try {
+      L{store, t};
+      std::cerr << t->description() << " was bound to a mismatched layout" << std::endl;
+      ok = false;
+    } catch (std::invalid_argument const&) {}
+  };
+  rejects(outer, static_cast<xst::TypedLayout<uint64_t, uint64_t>*>(nullptr));
+  rejects(holder, static_cast<xst::TypedLayout<uint8_t>*>(nullptr));
+
+  using CellLayout = xst::TypedLayout<uint64_t>;
+  xst::TypedLayout<CellLayout, uint64_t> o{store, outer};
+  CellLayout c{store, cell};
+  store.with_temporary_allocation(outer, 1, [&](void* p) {
+    c.view(o.view(p).address<0>()).get<0>() = 1;
+    o.view(p).get<1>() = 2;
+    if (store.describe_instance(outer, p) != "Outer(Cell(1), 2)") {
+      std::cerr << "a nested layout accessed the wrong fields" << std::endl;
+      ok = false;
+    }
+    store.deinitialize(outer, p);
+  });
+  return ok;
+}
+
+/// Returns the sum of `environment` and `x`.
+uint64_t add(uint64_t environment, uint64_t x) {
+  return environment + x;
+}
+
+/// Returns `true` iff lambdas compute the same results whether their stored function has been
+/// created by `implement` or follows the calling convention of the store directly, reporting
+/// failures to the standard error.
+bool verify_lambdas() {
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  auto type = store.declare_lambda({i64, i64, i64});
+  using Binding = xst::Lambda<uint64_t(uint64_t, uint64_t)>;
+  Binding binding{store, type};
+
+  auto ok = true;
+  auto check = [&](uint64_t result, char const* message) {
+    if (result != 11) {
+      std::cerr << message << std::endl;
+      ok = false;
+    }
+  };
+
+  store.with_temporary_allocation(type, 1, [&](void* p) {
+    binding.initialize(p, Binding::implement<add>(), 10);
+    check(binding(p, 1), "a call through an adapter failed");
+    binding.initialize(p, [](uint64_t* r, uint64_t* e, uint64_t* x) { *r = *e + *x; }, 10);
+    check(binding(p, 1), "a call through a stored function failed");
+  });
+  return ok;
+}
+
+/// Returns `true` iff copies into a region share the shared boxes allocated in that region and
+/// copy the others, reporting failures to the standard error.
+bool verify_regions() {
+  auto i64 = store.declare(xst::BuiltinHeader::i64);
+  auto shared = store.declare(xst::StructHeader{"Shared", {}});
+  store.define(shared, {xst::Field{i64, true, true}});
+  auto const& m = store[shared];
+
+  auto ok = true;
+  auto check = [&](bool condition, char const* message) {
+    if (!condition) {
+      std::cerr << message << std::endl;
+      ok = false;
+    }
+  };
+
+  store.with_temporary_allocation(shared, 3, [&](void* p) {
+    auto source = static_cast<std::byte*>(p);
+    auto first = source + store.stride(shared);
+    auto second = first + store.stride(shared);
+    store.copy_initialize_builtin<std::int64_t>(i64, store.address_of(m, 0, source), 7);
+
+    xst::Region region;
+    store.copy_initialize(shared, first, source, region);
+    store.copy_initialize(shared, second, first, region);
+    auto a = store.read_address_of(m, 0, source);
+    auto b = store.read_address_of(m, 0, first);
+    check(b != a, "a copy into a region shares a box allocated on the heap");
+    check(xst::reference_count(a) == 1, "a copy into a region holds a reference to the heap");
+    check(region.can_share(b), "a copy into a region copied a box outside of the region");
+    check(store.read_address_of(m, 0, second) == b, "a copy in a region copied a box");
+    check(store.equal_instances(shared, source, second), "a copy into a region isn't equal");
+
+    store.deinitialize(shared, second, region);
+    store.deinitialize(shared, first, region);
+    store.deinitialize(shared, source);
+  });
+  return ok;
+}
+
+/// Runs the self-checks of the demo, returning `true` iff they all succeeded.
+bool verify() {
+  auto ok = verify_kernels();
+  ok = verify_serialization() && ok;
+  ok = verify_aliased_images() && ok;
+  ok = verify_snapshots() && ok;
+  ok = verify_typed_layouts() && ok;
+  ok = verify_lambdas() && ok;
+  ok = verify_regions() && ok;
+  return ok;
 }
 
 }
@@ -46,6 +496,10 @@ void bar(uint64_t* result, uint64_t* e, uint64_t* n) {
 }
 
 int main(int argc, const char * argv[]) {
+  if ((argc > 1) && (std::string_view{argv[1]} == "--verify")) {
+    return rt::verify() ? 0 : 1;
+  }
+
   auto a0 = rt::store.declare(xst::BuiltinHeader::i64);
   auto a1 = rt::ListCons(a0);
   auto a2 = rt::ListEmpty(a0);
@@ -55,16 +509,17 @@ int main(int argc, const char * argv[]) {
   std::cout << "  size:      " << rt::store.size(a3) << std::endl;
   std::cout << "  alignment: " << rt::store.alignment(a3) << std::endl;
 
+  // The layout of List.Cons<Int64> is known statically: an integer followed by a box.
+  xst::TypedLayout<uint64_t, xst::Boxed<void>> cons{rt::store, a1};
+
   // Allocate List.Cons<Int64> on the stack.
-  rt::store.with_temporary_allocation(a1, 1, [&](auto p0) {
-    // Get the address of the `head` field, which is at index 0.
-    auto p1 = rt::store.address_of(a1, 0, p0);
-    // Write 42 to the `head` field.
-    rt::store.copy_initialize_builtin<uint64_t>(a0, p1, 42);
+  rt::store.with_temporary_allocation(a1, 1, [&](void* p0) {
+    // Write 42 to the `head` field, which is at index 0.
+    cons.view(p0).get<0>() = 42;
     // Allocate List.Empty<Int64> on the stack.
     rt::store.with_temporary_allocation(a2, 1, [&](auto p2) {
       // Get the address of the `tail` field, which is at index 1.
-      auto p3 = rt::store.address_of(a1, 1, p0);
+      auto p3 = cons.view(p0).address<1>();
       // Store a `List.Empty<Int64>` to the `tail` field, which has tag 1.
       rt::store.copy_initialize_enum(a3, 1, p3, p2);
       // Deinitializes the `List.Empty<Int64>` stored in `p2`.
@@ -85,23 +540,17 @@ int main(int argc, const char * argv[]) {
 
   auto a4 = rt::store.declare_lambda({ a0, a0, a0 });
 
-  /// Allocate storage for a lambda on the stack.
-  rt::store.with_temporary_allocation(a4, 1, [&](auto p5) {
-    // Write the address of `bar` to the lambda.
-    auto p6 = rt::store.address_of(a4, 0, p5);
-    rt::store.copy_initialize_function(p6, &bar);
+  // The API of the lambda is known statically: it takes and returns an integer and its
+  // environment is an integer.
+  xst::Lambda<uint64_t(uint64_t, uint64_t)> add{rt::store, a4};
 
-    // Write 10 to the environment of the lambda.
-    auto p7 = rt::store.address_of(a4, 1, p5);
-    rt::store.copy_initialize_builtin<uint64_t>(a0, p7, 10);
+  /// Allocate storage for a lambda on the stack.
+  rt::store.with_temporary_allocation(a4, 1, [&](void* p5) {
+    // Write the address of `bar` and an environment containing 10 to the lambda.
+    add.initialize(p5, &bar, 10);
 
     // Call the lambda.
-    auto f = *static_cast<xst::AnyFunction*>(p6);
-    auto g = reinterpret_cast<void(*)(uint64_t*,uint64_t*,uint64_t*)>(f);
-    auto e = static_cast<uint64_t*>(p7);
-    uint64_t result, n = 1;
-    g(&result, e, &n);
-    std::cout << result << std::endl;
+    std::cout << add(p5, 1) << std::endl;
   });
 
   return 0;